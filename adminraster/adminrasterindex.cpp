@@ -0,0 +1,1056 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <algorithm>
+#include <exception>
+
+// qt
+#include <QDebug>
+#include <QImage>
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QThreadPool>
+
+// kompex
+#include "KompexSQLitePrerequisites.h"
+#include "KompexSQLiteDatabase.h"
+#include "KompexSQLiteStatement.h"
+#include "KompexSQLiteException.h"
+#include "KompexSQLiteBlob.h"
+
+#include "adminrasterindex.h"
+
+namespace
+{
+    // value stored in a decoded tile for
+    // pixels that don't have a region
+    quint16 const kNoRegion = kTileNoRegion;
+}
+
+struct AdminRasterIndex::Tile
+{
+    int idx;
+    QByteArray data;    // uncompressed block tile
+    QByteArray refined; // uncompressed refined tile or empty
+
+    // clock reference bit, set whenever
+    // the tile is used for a lookup
+    QAtomicInt referenced;
+};
+
+class AdminRasterIndex::BatchTask : public QRunnable
+{
+public:
+    BatchTask(AdminRasterIndex * index,
+              double const * lonlat, int count, int * ids,
+              int firstTile) :
+        m_index(index),
+        m_lonlat(lonlat),
+        m_count(count),
+        m_ids(ids),
+        m_firstTile(firstTile)
+    {
+        setAutoDelete(true);
+    }
+
+    void run()
+    {
+        Kompex::SQLiteDatabase * database = m_index->acquireConnection();
+        m_index->lookupBatch(m_lonlat,m_count,m_ids,m_firstTile,database);
+        m_index->releaseConnection(database);
+    }
+
+private:
+    AdminRasterIndex * m_index;
+    double const * m_lonlat;
+    int m_count;
+    int * m_ids;
+    int m_firstTile;
+};
+
+AdminRasterIndex::AdminRasterIndex() :
+    m_tileFormat(TILE_FORMAT_PNG),
+    m_refineFactor(1),
+    m_localityOrder(false),
+    m_tileLayout(kTileBlockZOrder),
+    m_clockHand(0),
+    m_maxCachedTiles(64),
+    m_hasGeometry(false),
+    m_exactBoundaries(true)
+{
+    // empty
+}
+
+AdminRasterIndex::~AdminRasterIndex()
+{
+    close();
+}
+
+bool AdminRasterIndex::open(QString const &pathDatabase)
+{
+    close();
+
+    m_pathDatabase = pathDatabase;
+    Kompex::SQLiteDatabase * database = acquireConnection();
+    if(database == NULL)   {
+        return false;
+    }
+    releaseConnection(database);
+
+    if(!loadMeta() || !loadRegions())   {
+        close();
+        return false;
+    }
+    m_grid.getTileCurveOrder(m_listTileOrder);
+    m_listTileRank.resize(m_listTileOrder.size());
+    for(int i=0; i < m_listTileOrder.size(); i++)   {
+        m_listTileRank[m_listTileOrder[i]] = i;
+    }
+
+    return true;
+}
+
+bool AdminRasterIndex::openFlatRaster(QString const &pathFile)
+{
+    if(!isOpen())   {
+        qDebug() << "ERROR: Open the database before the flat raster";
+        return false;
+    }
+
+    if(!m_flatRaster.open(pathFile))   {
+        return false;
+    }
+
+    if(m_flatRaster.tileSize() != m_grid.tileSize ||
+       m_flatRaster.tileCount() != m_grid.tileCount())   {
+        qDebug() << "ERROR: Flat raster doesn't match the database";
+        m_flatRaster.close();
+        return false;
+    }
+
+    // tiles come straight from the mapped file now
+    clearCache();
+    return true;
+}
+
+void AdminRasterIndex::close()
+{
+    m_flatRaster.close();
+    clearCache();
+    m_listRegions.clear();
+
+    {
+        QWriteLocker locker(&m_geometryLock);
+        m_geometryCache.clear();
+        m_hasGeometry = false;
+    }
+
+    QMutexLocker locker(&m_connectionMutex);
+    qDeleteAll(m_listConnections);
+    m_listConnections.clear();
+    m_listFreeConnections.clear();
+    m_pathDatabase.clear();
+}
+
+bool AdminRasterIndex::isOpen() const
+{
+    return !m_listConnections.isEmpty();
+}
+
+void AdminRasterIndex::setMaxCachedTiles(int maxTiles)
+{
+    QWriteLocker locker(&m_cacheLock);
+    m_maxCachedTiles = std::max(maxTiles,1);
+
+    while(m_clockRing.size() > m_maxCachedTiles)   {
+        m_tileCache.remove(m_clockRing.last());
+        m_clockRing.pop_back();
+    }
+    m_clockHand = 0;
+}
+
+int AdminRasterIndex::maxCachedTiles() const
+{
+    return m_maxCachedTiles;
+}
+
+int AdminRasterIndex::lookupId(double lon, double lat)
+{
+    size_t tileIdx,pixel_x,pixel_y;
+
+    // ids in a flat raster are sampled in place so
+    // they're checked against the regions here
+    if(m_flatRaster.isOpen())   {
+        getTilePixel(lon,lat,tileIdx,pixel_x,pixel_y);
+        uchar const * tileData = m_flatRaster.tileData(tileIdx);
+        if(tileData == NULL)   {
+            return -1;
+        }
+        quint16 sample = m_flatRaster.sampleTile(tileData,pixel_x,pixel_y);
+        int id = regionId(sample);
+
+        if(m_hasGeometry && m_exactBoundaries)   {
+            int listIds[8];
+            int numIds = getFlatNeighbourIds(tileIdx,tileData,pixel_x,pixel_y,
+                                             id,listIds);
+            if(numIds > 0)   {
+                id = resolveBoundary(lon,lat,id,listIds,numIds,NULL);
+            }
+        }
+        return id;
+    }
+
+    m_fineGrid.getTilePixel(lon,lat,tileIdx,pixel_x,pixel_y);
+    TilePtr tile = getTile(tileIdx);
+    if(tile.isNull())   {
+        return -1;
+    }
+
+    int id = sampleTile(*tile,pixel_x,pixel_y);
+    if(m_hasGeometry && m_exactBoundaries)   {
+        int listIds[8];
+        int numIds = getNeighbourIds(*tile,pixel_x,pixel_y,id,listIds,NULL);
+        if(numIds > 0)   {
+            id = resolveBoundary(lon,lat,id,listIds,numIds,NULL);
+        }
+    }
+    return id;
+}
+
+bool AdminRasterIndex::lookup(double lon, double lat, AdminRegion &region)
+{
+    int id = lookupId(lon,lat);
+    if(id < 0)   {
+        return false;
+    }
+    region = m_listRegions[id];
+    return true;
+}
+
+void AdminRasterIndex::lookupIds(double const * lonlat, int count, int * ids)
+{
+    lookupBatch(lonlat,count,ids,0,NULL);
+}
+
+void AdminRasterIndex::lookupIds(double const * lonlat, int count, int * ids,
+                                 int numThreads)
+{
+    numThreads = std::max(1,std::min(numThreads,count/1024));
+    if(numThreads == 1)   {
+        lookupBatch(lonlat,count,ids,0,NULL);
+        return;
+    }
+
+    // give each worker a contiguous range of points; every
+    // worker walks the tiles starting from a different one
+    // so they don't all wait on the same tile being read in
+    QThreadPool pool;
+    pool.setMaxThreadCount(numThreads);
+
+    int pointStart = 0;
+    for(int i=0; i < numThreads; i++)   {
+        int pointEnd = qint64(count)*(i+1)/numThreads;
+        int firstTile = m_grid.tileCount()*i/numThreads;
+        pool.start(new BatchTask(this,
+                                 lonlat+pointStart*2,
+                                 pointEnd-pointStart,
+                                 ids+pointStart,
+                                 firstTile));
+        pointStart = pointEnd;
+    }
+    pool.waitForDone();
+}
+
+bool AdminRasterIndex::hasGeometry() const
+{
+    return m_hasGeometry;
+}
+
+void AdminRasterIndex::setExactBoundaries(bool exact)
+{
+    m_exactBoundaries = exact;
+}
+
+bool AdminRasterIndex::exactBoundaries() const
+{
+    return m_exactBoundaries;
+}
+
+qint64 AdminRasterIndex::cachedGeometryBytes() const
+{
+    QReadLocker locker(&m_geometryLock);
+
+    qint64 numBytes = 0;
+    QHash<int,GeometryPtr>::const_iterator it;
+    for(it = m_geometryCache.constBegin(); it != m_geometryCache.constEnd(); ++it)   {
+        if(!it.value().isNull())   {
+            numBytes += it.value()->byteSize();
+        }
+    }
+    return numBytes;
+}
+
+void AdminRasterIndex::setLocalityOrder(bool ordered)
+{
+    m_localityOrder = ordered;
+}
+
+bool AdminRasterIndex::localityOrder() const
+{
+    return m_localityOrder;
+}
+
+void AdminRasterIndex::setTileLayout(quint16 layout)
+{
+    if(layout != kTileBlockRowMajor && layout != kTileBlockZOrder)   {
+        qDebug() << "ERROR: Unknown tile layout" << layout;
+        return;
+    }
+    if(layout != m_tileLayout)   {
+        m_tileLayout = layout;
+        clearCache();
+    }
+}
+
+quint16 AdminRasterIndex::tileLayout() const
+{
+    return m_tileLayout;
+}
+
+RasterGrid const & AdminRasterIndex::grid() const
+{
+    return m_grid;
+}
+
+int AdminRasterIndex::refineFactor() const
+{
+    return m_refineFactor;
+}
+
+int AdminRasterIndex::tileCount() const
+{
+    return m_grid.tileCount();
+}
+
+qint64 AdminRasterIndex::cachedTileBytes() const
+{
+    QReadLocker locker(&m_cacheLock);
+
+    qint64 numBytes = 0;
+    QHash<int,TilePtr>::const_iterator it;
+    for(it = m_tileCache.constBegin(); it != m_tileCache.constEnd(); ++it)   {
+        numBytes += it.value()->data.size() + it.value()->refined.size();
+    }
+    return numBytes;
+}
+
+AdminRegion const & AdminRasterIndex::region(int id) const
+{
+    if(id < 0 || id >= m_listRegions.size())   {
+        return m_noRegion;
+    }
+    return m_listRegions[id];
+}
+
+int AdminRasterIndex::regionCount() const
+{
+    return m_listRegions.size();
+}
+
+void AdminRasterIndex::getTilePixel(double lon,
+                                    double lat,
+                                    size_t &tile_idx,
+                                    size_t &pixel_x,
+                                    size_t &pixel_y) const
+{
+    m_grid.getTilePixel(lon,lat,tile_idx,pixel_x,pixel_y);
+}
+
+bool AdminRasterIndex::loadMeta()
+{
+    // databases without a meta table
+    // store tiles as png images
+    m_tileFormat = TILE_FORMAT_PNG;
+    m_tileColumn = "png";
+    m_grid = RasterGrid();
+    m_refineFactor = 1;
+    m_fineGrid = m_grid;
+
+    try   {
+        Kompex::SQLiteStatement stmt(m_listConnections.first());
+
+        stmt.Sql("SELECT name FROM sqlite_master "
+                 "WHERE type='table' AND name='geometry';");
+        m_hasGeometry = stmt.FetchRow();
+        stmt.FreeQuery();
+
+        stmt.Sql("SELECT name FROM sqlite_master "
+                 "WHERE type='table' AND name='meta';");
+        bool hasMeta = stmt.FetchRow();
+        stmt.FreeQuery();
+        if(!hasMeta)   {
+            return true;
+        }
+
+        m_tileColumn = "data";
+
+        stmt.Sql("SELECT key,value FROM meta;");
+        while(stmt.FetchRow())   {
+            QString key = QString::fromStdString(stmt.GetColumnString(0));
+            QString value = QString::fromStdString(stmt.GetColumnString(1));
+
+            if(key == "tile_format")   {
+                if(!tileFormatFromName(value,m_tileFormat))   {
+                    qDebug() << "ERROR: Unknown tile format" << value;
+                    stmt.FreeQuery();
+                    return false;
+                }
+            }
+            else if(key == "resolution")   {
+                m_grid.resolution = value.toInt();
+            }
+            else if(key == "tile_size")   {
+                m_grid.tileSize = value.toInt();
+            }
+            else if(key == "refine_factor")   {
+                m_refineFactor = value.toInt();
+            }
+        }
+        stmt.FreeQuery();
+
+        if(!m_grid.isValid())   {
+            qDebug() << "ERROR: Bad raster resolution or tile size"
+                     << m_grid.resolution << m_grid.tileSize;
+            return false;
+        }
+
+        if(m_refineFactor < 1 || m_refineFactor > kTileRefineMaxFactor)   {
+            qDebug() << "ERROR: Bad refine factor" << m_refineFactor;
+            return false;
+        }
+        m_fineGrid = RasterGrid(m_grid.resolution*m_refineFactor,
+                                m_grid.tileSize*m_refineFactor);
+        if(!m_fineGrid.isIndexable())   {
+            qDebug() << "ERROR: Refine factor" << m_refineFactor
+                     << "is too large for this grid";
+            return false;
+        }
+    }
+    catch(Kompex::SQLiteException &exception)   {
+        qDebug() << "ERROR: Could not read database meta data:";
+        qDebug() << QString::fromStdString(exception.GetString());
+        return false;
+    }
+
+    return true;
+}
+
+bool AdminRasterIndex::loadRegions()
+{
+    try   {
+        Kompex::SQLiteStatement stmt(m_listConnections.first());
+
+        // newer databases have every region's names
+        // in a single denormalized table
+        stmt.Sql("SELECT name FROM sqlite_master "
+                 "WHERE type='table' AND name='region';");
+        bool hasRegion = stmt.FetchRow();
+        stmt.FreeQuery();
+
+        if(hasRegion)   {
+            stmt.Sql("SELECT id,admin1,IFNULL(admin0,'N/A'),"
+                     "IFNULL(sov,'N/A'),disputed FROM region;");
+        }
+        else   {
+            stmt.Sql("SELECT admin1.id,admin1.name,"
+                     "IFNULL(admin0.name,'N/A'),"
+                     "IFNULL(sov.name,'N/A'),admin1.disputed "
+                     "FROM admin1 "
+                     "LEFT JOIN admin0 ON admin0.id=admin1.admin0 "
+                     "LEFT JOIN sov ON sov.id=admin1.sov;");
+        }
+
+        while(stmt.FetchRow())   {
+            int idx = stmt.GetColumnInt(0);
+            if(idx < 0 || idx >= kNoRegion)   {
+                continue;
+            }
+            if(idx >= m_listRegions.size())   {
+                m_listRegions.resize(idx+1);
+            }
+
+            AdminRegion &region = m_listRegions[idx];
+            region.id = idx;
+            region.admin1 = QString::fromUtf8(stmt.GetColumnString(1).c_str());
+            region.admin0 = QString::fromUtf8(stmt.GetColumnString(2).c_str());
+            region.sov = QString::fromUtf8(stmt.GetColumnString(3).c_str());
+            region.disputed = stmt.GetColumnBool(4);
+        }
+        stmt.FreeQuery();
+    }
+    catch(Kompex::SQLiteException &exception)   {
+        qDebug() << "ERROR: Could not read admin regions:";
+        qDebug() << QString::fromStdString(exception.GetString());
+        return false;
+    }
+
+    return true;
+}
+
+AdminRasterIndex::TilePtr AdminRasterIndex::getTile(int tile_idx,
+                                                    Kompex::SQLiteDatabase * database)
+{
+    {
+        QReadLocker locker(&m_cacheLock);
+        TilePtr tile = m_tileCache.value(tile_idx);
+        if(!tile.isNull())   {
+            // only write the reference bit if it isn't already
+            // set so hot tiles don't bounce between cpu caches
+            if(!tile->referenced)   {
+                tile->referenced = 1;
+            }
+            return tile;
+        }
+    }
+
+    // wait if another thread is already reading in this tile,
+    // otherwise mark it as being read in by this thread
+    {
+        QMutexLocker locker(&m_loadMutex);
+        while(m_loadingTiles.contains(tile_idx))   {
+            m_loadDone.wait(&m_loadMutex);
+        }
+
+        QReadLocker cacheLocker(&m_cacheLock);
+        TilePtr tile = m_tileCache.value(tile_idx);
+        if(!tile.isNull())   {
+            return tile;
+        }
+        m_loadingTiles.insert(tile_idx);
+    }
+
+    // use the caller's connection if it has one
+    TilePtr tile;
+    if(database)   {
+        tile = loadTile(tile_idx,database);
+    }
+    else   {
+        database = acquireConnection();
+        tile = loadTile(tile_idx,database);
+        releaseConnection(database);
+    }
+
+    if(!tile.isNull())   {
+        insertTile(tile);
+    }
+
+    QMutexLocker locker(&m_loadMutex);
+    m_loadingTiles.remove(tile_idx);
+    m_loadDone.wakeAll();
+
+    return tile;
+}
+
+AdminRasterIndex::TilePtr AdminRasterIndex::loadTile(int tile_idx,
+                                                     Kompex::SQLiteDatabase * database)
+{
+    if(database == NULL || tile_idx < 0 || tile_idx >= m_grid.tileCount())   {
+        return TilePtr();
+    }
+
+    // get tile data from the database
+    QByteArray tileBlob;
+    try   {
+        Kompex::SQLiteBlob blob(database,"main","tiles",m_tileColumn,
+                                tile_idx,Kompex::BLOB_READONLY);
+
+        tileBlob.resize(blob.GetBlobSize());
+        blob.ReadBlob(tileBlob.data(),tileBlob.size());
+    }
+    catch(Kompex::SQLiteException &exception)   {
+        qDebug() << "ERROR: Could not read tile" << tile_idx;
+        qDebug() << QString::fromStdString(exception.GetString());
+        return TilePtr();
+    }
+
+    QVector<quint16> listIds;
+    if(!decodeTileIds(tileBlob,m_grid.tileSize,m_tileFormat,listIds))   {
+        qDebug() << "ERROR: Could not decode tile" << tile_idx;
+        return TilePtr();
+    }
+
+    // anything that isn't a known region becomes kNoRegion
+    quint16 * ids = listIds.data();
+    for(int i=0; i < listIds.size(); i++)   {
+        if(regionId(ids[i]) < 0)   {
+            ids[i] = kNoRegion;
+        }
+    }
+
+    // tiles are kept as block tiles regardless of how
+    // they're stored so uniform tiles and blocks take up
+    // next to no memory
+    TilePtr tile(new Tile);
+    tile->idx = tile_idx;
+    tile->referenced = 1;
+    encodeBlockTile(listIds,m_grid.tileSize,tile->data,m_tileLayout);
+
+    // only tiles that have blocks along a boundary have
+    // a row in the refined table
+    if(m_refineFactor > 1 && tile->data[0] != 0)   {
+        QByteArray refinedBlob;
+        try   {
+            Kompex::SQLiteBlob blob(database,"main","refined","data",
+                                    tile_idx,Kompex::BLOB_READONLY);
+
+            refinedBlob.resize(blob.GetBlobSize());
+            blob.ReadBlob(refinedBlob.data(),refinedBlob.size());
+        }
+        catch(Kompex::SQLiteException &)   {
+            // no refined blocks
+        }
+
+        if(!refinedBlob.isEmpty())   {
+            tile->refined = qUncompress(refinedBlob);
+            if(!checkRefinedTile(tile->refined,m_refineFactor))   {
+                qDebug() << "ERROR: Bad refined tile" << tile_idx;
+                return TilePtr();
+            }
+        }
+    }
+
+    return tile;
+}
+
+void AdminRasterIndex::insertTile(TilePtr const &tile)
+{
+    QWriteLocker locker(&m_cacheLock);
+
+    if(m_clockRing.size() < m_maxCachedTiles)   {
+        m_clockRing.push_back(tile->idx);
+        m_tileCache.insert(tile->idx,tile);
+        return;
+    }
+
+    // advance the clock hand until we find a tile that
+    // hasn't been used since the hand last passed it;
+    // threads still using the evicted tile keep their
+    // own reference to it
+    while(true)   {
+        TilePtr const &candidate = m_tileCache[m_clockRing[m_clockHand]];
+        if(candidate->referenced)   {
+            candidate->referenced = 0;
+            m_clockHand = (m_clockHand+1) % m_clockRing.size();
+            continue;
+        }
+
+        m_tileCache.remove(m_clockRing[m_clockHand]);
+        m_clockRing[m_clockHand] = tile->idx;
+        m_tileCache.insert(tile->idx,tile);
+        m_clockHand = (m_clockHand+1) % m_clockRing.size();
+        break;
+    }
+}
+
+void AdminRasterIndex::clearCache()
+{
+    QWriteLocker locker(&m_cacheLock);
+    m_tileCache.clear();
+    m_clockRing.clear();
+    m_clockHand = 0;
+}
+
+int AdminRasterIndex::sampleTile(Tile const &tile, int fine_x, int fine_y) const
+{
+    int const factor = m_refineFactor;
+    uchar const * tileData =
+            reinterpret_cast<uchar const *>(tile.data.constData());
+
+    quint16 id = sampleBlockTile(tileData,m_grid.tileSize,
+                                 fine_x/factor,fine_y/factor);
+
+    // the refined ids haven't been checked against the regions
+    quint16 fineId;
+    if(!tile.refined.isEmpty() &&
+       sampleRefinedTile(reinterpret_cast<uchar const *>(tile.refined.constData()),
+                         m_grid.tileSize,fine_x,fine_y,fineId))   {
+        return regionId(fineId);
+    }
+
+    return (id == kNoRegion) ? -1 : int(id);
+}
+
+Kompex::SQLiteDatabase * AdminRasterIndex::acquireConnection()
+{
+    QMutexLocker locker(&m_connectionMutex);
+    if(!m_listFreeConnections.isEmpty())   {
+        return m_listFreeConnections.takeLast();
+    }
+
+    // each connection is only ever used by one
+    // thread at a time so sqlite doesn't need
+    // to do any locking of its own
+    Kompex::SQLiteDatabase * database = NULL;
+    try   {
+        database = new Kompex::SQLiteDatabase(
+                    m_pathDatabase.toStdString(),
+                    SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,0);
+    }
+    catch(Kompex::SQLiteException &exception)   {
+        qDebug() << "ERROR: Could not open database:";
+        qDebug() << QString::fromStdString(exception.GetString());
+        return NULL;
+    }
+
+    m_listConnections.push_back(database);
+    return database;
+}
+
+void AdminRasterIndex::releaseConnection(Kompex::SQLiteDatabase * database)
+{
+    if(database == NULL)   {
+        return;
+    }
+
+    QMutexLocker locker(&m_connectionMutex);
+    m_listFreeConnections.push_back(database);
+}
+
+int AdminRasterIndex::getNeighbourIds(Tile const &tile,
+                                      int fine_x, int fine_y,
+                                      int id, int * listIds,
+                                      Kompex::SQLiteDatabase * database)
+{
+    int const factor = m_refineFactor;
+    if(isBlockInterior(reinterpret_cast<uchar const *>(tile.data.constData()),
+                       m_grid.tileSize,fine_x/factor,fine_y/factor))   {
+        return 0;
+    }
+
+    // neighbours past the edge of the tile are
+    // sampled from the tile they're in
+    int const size = m_grid.tileSize*factor;
+    TilePtr nTile;
+    int numIds = 0;
+    for(int y=fine_y-1; y <= fine_y+1; y++)   {
+        for(int x=fine_x-1; x <= fine_x+1; x++)   {
+            int nId;
+            if(x >= 0 && y >= 0 && x < size && y < size)   {
+                nId = sampleTile(tile,x,y);
+            }
+            else   {
+                int nTile_idx,nx,ny;
+                if(!m_fineGrid.getNeighbourPixel(tile.idx,x,y,nTile_idx,nx,ny))   {
+                    continue;
+                }
+                if(nTile.isNull() || nTile->idx != nTile_idx)   {
+                    nTile = getTile(nTile_idx,database);
+                    if(nTile.isNull())   {
+                        continue;
+                    }
+                }
+                nId = sampleTile(*nTile,nx,ny);
+            }
+
+            if(nId != id && std::find(listIds,listIds+numIds,nId) == listIds+numIds)   {
+                listIds[numIds++] = nId;
+            }
+        }
+    }
+    return numIds;
+}
+
+int AdminRasterIndex::getFlatNeighbourIds(int tile_idx,
+                                          uchar const * tileData,
+                                          int x, int y,
+                                          int id, int * listIds) const
+{
+    if(tileData == NULL || m_flatRaster.isInterior(tileData,x,y))   {
+        return 0;
+    }
+
+    int const size = m_grid.tileSize;
+    int numIds = 0;
+    for(int ny=y-1; ny <= y+1; ny++)   {
+        for(int nx=x-1; nx <= x+1; nx++)   {
+            quint16 sample;
+            if(nx >= 0 && ny >= 0 && nx < size && ny < size)   {
+                sample = m_flatRaster.sampleTile(tileData,nx,ny);
+            }
+            else   {
+                int nTile_idx,tx,ty;
+                if(!m_grid.getNeighbourPixel(tile_idx,nx,ny,nTile_idx,tx,ty))   {
+                    continue;
+                }
+                uchar const * nTileData = m_flatRaster.tileData(nTile_idx);
+                if(nTileData == NULL)   {
+                    continue;
+                }
+                sample = m_flatRaster.sampleTile(nTileData,tx,ty);
+            }
+
+            int nId = regionId(sample);
+            if(nId != id && std::find(listIds,listIds+numIds,nId) == listIds+numIds)   {
+                listIds[numIds++] = nId;
+            }
+        }
+    }
+    return numIds;
+}
+
+int AdminRasterIndex::resolveBoundary(double lon, double lat, int id,
+                                      int const * listIds, int numIds,
+                                      Kompex::SQLiteDatabase * database)
+{
+    double const x = lon+180.0;
+    double const y = 90.0-lat;
+
+    // the raster's id is the most likely answer so it's
+    // checked first, followed by the ids around it
+    bool checkedAll = true;
+    for(int i=-1; i < numIds; i++)   {
+        int candidate = (i < 0) ? id : listIds[i];
+        if(candidate < 0)   {
+            continue;
+        }
+
+        GeometryPtr geometry = getGeometry(candidate,database);
+        if(geometry.isNull())   {
+            checkedAll = false;
+            continue;
+        }
+        if(geometry->contains(x,y))   {
+            return candidate;
+        }
+    }
+
+    // the point isn't in any of the regions around it,
+    // unless one of them doesn't have any geometry
+    return checkedAll ? -1 : id;
+}
+
+AdminRasterIndex::GeometryPtr AdminRasterIndex::getGeometry(int id,
+                                                            Kompex::SQLiteDatabase * database)
+{
+    {
+        QReadLocker locker(&m_geometryLock);
+        QHash<int,GeometryPtr>::const_iterator it = m_geometryCache.constFind(id);
+        if(it != m_geometryCache.constEnd())   {
+            return it.value();
+        }
+    }
+
+    // two threads can read in the same region at the
+    // same time; the first one to finish is kept
+    bool ownConnection = (database == NULL);
+    if(ownConnection)   {
+        database = acquireConnection();
+    }
+
+    QByteArray geometryBlob;
+    if(database)   {
+        try   {
+            Kompex::SQLiteBlob blob(database,"main","geometry","data",
+                                    id,Kompex::BLOB_READONLY);
+
+            geometryBlob.resize(blob.GetBlobSize());
+            blob.ReadBlob(geometryBlob.data(),geometryBlob.size());
+        }
+        catch(Kompex::SQLiteException &)   {
+            // no geometry for this region
+        }
+    }
+
+    if(ownConnection)   {
+        releaseConnection(database);
+    }
+
+    GeometryPtr geometry;
+    if(!geometryBlob.isEmpty())   {
+        geometry = GeometryPtr(new RegionGeometry);
+        if(!geometry->decode(geometryBlob))   {
+            qDebug() << "ERROR: Bad geometry for region" << id;
+            geometry.clear();
+        }
+    }
+
+    QWriteLocker locker(&m_geometryLock);
+    QHash<int,GeometryPtr>::const_iterator it = m_geometryCache.constFind(id);
+    if(it != m_geometryCache.constEnd())   {
+        return it.value();
+    }
+    m_geometryCache.insert(id,geometry);
+    return geometry;
+}
+
+void AdminRasterIndex::lookupBatch(double const * lonlat, int count, int * ids,
+                                   int firstTile,
+                                   Kompex::SQLiteDatabase * database)
+{
+    QVector<int> listPointKey(count);
+    QVector<quint32> listPointPixel(count);
+    QVector<int> listOrder(count);
+    QVector<int> listRunStart;
+    int const tileCount = m_grid.tileCount();
+
+    // pixels are in the refined grid unless tiles come
+    // from the flat raster, which only has the base tiles
+    RasterGrid const &grid = m_flatRaster.isOpen() ? m_grid : m_fineGrid;
+
+    // points on boundary pixels are checked against
+    // the geometry of the regions around them
+    bool const checkBoundaries = m_hasGeometry && m_exactBoundaries;
+    int listIds[8];
+
+    int * pointKey = listPointKey.data();
+    quint32 * pointPixel = listPointPixel.data();
+    int * order = listOrder.data();
+
+    // get the tile and pixel offset of each point; the tile
+    // is replaced by its position in the order tiles are
+    // visited in, starting from firstTile
+    grid.getTilePixels(lonlat,count,pointKey,pointPixel);
+    int numPoints = 0;
+    for(int i=0; i < count; i++)   {
+        int t = pointKey[i];
+        if(t < 0)   {
+            ids[i] = -1;
+            continue;
+        }
+        if(m_localityOrder)   {
+            t = m_listTileRank[t];
+        }
+        pointKey[i] = (t >= firstTile) ? t-firstTile : t-firstTile+tileCount;
+        numPoints++;
+    }
+
+    // group points by key into runs; small batches sort the
+    // points they have instead of going over every tile
+    if(qint64(numPoints)*4 < tileCount)   {
+        QVector<quint64> listKeys(numPoints);
+        quint64 * keys = listKeys.data();
+        int k = 0;
+        for(int i=0; i < count; i++)   {
+            if(pointKey[i] >= 0)   {
+                keys[k++] = (quint64(pointKey[i]) << 32) | quint64(i);
+            }
+        }
+        std::sort(keys,keys+numPoints);
+        for(int j=0; j < numPoints; j++)   {
+            order[j] = int(keys[j] & 0xFFFFFFFF);
+            if(j == 0 || pointKey[order[j]] != pointKey[order[j-1]])   {
+                listRunStart.push_back(j);
+            }
+        }
+    }
+    else   {
+        // counting sort
+        QVector<int> listBucketEnd(tileCount+1,0);
+        int * bucketEnd = listBucketEnd.data();
+        for(int i=0; i < count; i++)   {
+            if(pointKey[i] >= 0)   {
+                bucketEnd[pointKey[i]+1]++;
+            }
+        }
+        for(int k=0; k < tileCount; k++)   {
+            if(bucketEnd[k+1] > 0)   {
+                listRunStart.push_back(bucketEnd[k]);
+            }
+            bucketEnd[k+1] += bucketEnd[k];
+        }
+        for(int i=0; i < count; i++)   {
+            if(pointKey[i] >= 0)   {
+                order[bucketEnd[pointKey[i]]++] = i;
+            }
+        }
+    }
+    listRunStart.push_back(numPoints);
+
+    // sample each tile once for all of its points
+    QVector<quint64> listKeys;
+    for(int r=0; r+1 < listRunStart.size(); r++)   {
+        int const bStart = listRunStart[r];
+        int const bEnd = listRunStart[r+1];
+        int t = pointKey[order[bStart]]+firstTile;
+        if(t >= tileCount)   {
+            t -= tileCount;
+        }
+        if(m_localityOrder)   {
+            t = m_listTileOrder[t];
+        }
+
+        // sort the tile's points by (pixel code << 32 | point)
+        if(m_localityOrder && bEnd-bStart > 1)   {
+            listKeys.resize(bEnd-bStart);
+            quint64 * keys = listKeys.data();
+            for(int j=bStart; j < bEnd; j++)   {
+                int i = order[j];
+                quint64 code = mortonCode(pointPixel[i] & 0xFFFF,pointPixel[i] >> 16);
+                keys[j-bStart] = (code << 32) | quint64(i);
+            }
+            std::sort(keys,keys+(bEnd-bStart));
+            for(int j=bStart; j < bEnd; j++)   {
+                order[j] = int(keys[j-bStart] & 0xFFFFFFFF);
+            }
+        }
+
+        if(m_flatRaster.isOpen())   {
+            uchar const * tileData = m_flatRaster.tileData(t);
+            for(int j=bStart; j < bEnd; j++)   {
+                int i = order[j];
+                quint16 id = kNoRegion;
+                int const x = pointPixel[i] & 0xFFFF;
+                int const y = pointPixel[i] >> 16;
+                if(tileData)   {
+                    id = m_flatRaster.sampleTile(tileData,x,y);
+                }
+                ids[i] = regionId(id);
+
+                if(checkBoundaries)   {
+                    int numIds = getFlatNeighbourIds(t,tileData,x,y,ids[i],listIds);
+                    if(numIds > 0)   {
+                        ids[i] = resolveBoundary(lonlat[i*2],lonlat[i*2+1],
+                                                 ids[i],listIds,numIds,database);
+                    }
+                }
+            }
+            continue;
+        }
+
+        TilePtr tile = getTile(t,database);
+        if(tile.isNull())   {
+            for(int j=bStart; j < bEnd; j++)   {
+                ids[order[j]] = -1;
+            }
+            continue;
+        }
+
+        for(int j=bStart; j < bEnd; j++)   {
+            int i = order[j];
+            int const x = pointPixel[i] & 0xFFFF;
+            int const y = pointPixel[i] >> 16;
+            ids[i] = sampleTile(*tile,x,y);
+
+            if(checkBoundaries)   {
+                int numIds = getNeighbourIds(*tile,x,y,ids[i],listIds,database);
+                if(numIds > 0)   {
+                    ids[i] = resolveBoundary(lonlat[i*2],lonlat[i*2+1],
+                                             ids[i],listIds,numIds,database);
+                }
+            }
+        }
+    }
+}
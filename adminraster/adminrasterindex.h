@@ -0,0 +1,265 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef ADMINRASTERINDEX_H
+#define ADMINRASTERINDEX_H
+
+#include <cstddef>
+#include <string>
+
+// qt
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QSharedPointer>
+#include <QReadWriteLock>
+#include <QMutex>
+#include <QWaitCondition>
+
+// adminraster
+#include "tilecodec.h"
+#include "flatraster.h"
+#include "rastergrid.h"
+#include "regiongeometry.h"
+
+namespace Kompex
+{
+    class SQLiteDatabase;
+}
+
+// admin data for a single admin1 raster id
+struct AdminRegion
+{
+    AdminRegion() : id(-1),disputed(false) {}
+
+    int id;             // -1 if there's no region
+    QString admin1;
+    QString admin0;
+    QString sov;
+    bool disputed;
+};
+
+// AdminRasterIndex keeps an adminraster.sqlite database
+// open and answers point lookups against it. Decoded tiles
+// are kept in a bounded cache keyed by tile id and the
+// admin1/admin0/sov names are read into memory on open, so
+// a lookup against a cached tile does not touch SQLite or
+// decode any image data.
+// Lookups are thread safe. The tile cache is shared by all
+// threads and only locked for writing when a tile is added
+// to it; tiles that aren't cached are read using a SQLite
+// connection that is owned by the calling thread for the
+// duration of the read
+class AdminRasterIndex
+{
+public:
+    AdminRasterIndex();
+    ~AdminRasterIndex();
+
+    bool open(QString const &pathDatabase);
+    void close();
+    bool isOpen() const;
+
+    // serve tiles from a memory mapped flat raster file
+    // written by shp2adminraster instead of decoding them
+    // from the database; the OS page cache takes the place
+    // of the tile cache and is shared between processes.
+    // The database must be opened first for the region names
+    bool openFlatRaster(QString const &pathFile);
+
+    // maximum number of decoded tiles kept in memory; a
+    // decoded tile takes up at most a little over 2 bytes
+    // per pixel and tiles that are all one region take up
+    // a few bytes
+    void setMaxCachedTiles(int maxTiles);
+    int maxCachedTiles() const;
+
+    // returns the admin1 id at the given coordinates or
+    // -1 if there's no region there; lon and lat must be
+    // in [-180,180] and [-90,90]
+    int lookupId(double lon, double lat);
+
+    // sets region to the admin data at the given coordinates
+    // and returns true, or returns false if there's no region
+    bool lookup(double lon, double lat, AdminRegion &region);
+
+    // looks up count points at once; lonlat holds interleaved
+    // lon,lat pairs and ids receives the admin1 id (or -1) of
+    // each point in input order. Points are grouped by tile
+    // before sampling so every tile touched by the batch is
+    // only fetched once
+    void lookupIds(double const * lonlat, int count, int * ids);
+
+    // same as above but splits the points across numThreads
+    // worker threads that share the tile cache; each worker
+    // has its own SQLite connection to read in missing tiles
+    void lookupIds(double const * lonlat, int count, int * ids,
+                   int numThreads);
+
+    // true if the database has a geometry table with
+    // the rings of the admin1 regions
+    bool hasGeometry() const;
+
+    // when the database has region geometry, a lookup that
+    // lands on a pixel next to a pixel of a different region
+    // is checked against the geometry of those regions with
+    // a point in polygon test instead of trusting the raster;
+    // lookups on every other pixel only sample the raster.
+    // On by default
+    void setExactBoundaries(bool exact);
+    bool exactBoundaries() const;
+
+    // bytes used by the decoded region geometry
+    qint64 cachedGeometryBytes() const;
+
+    // when set, batch lookups visit tiles in Z-order and
+    // sample the points in each tile in Z-order of their
+    // pixels instead of in input order, so points that are
+    // close together are looked up one after the other;
+    // ids are still returned in input order. Off by default
+    void setLocalityOrder(bool ordered);
+    bool localityOrder() const;
+
+    // layout of the decoded block tiles in the cache, either
+    // kTileBlockZOrder (the default) or kTileBlockRowMajor;
+    // changing it empties the cache. Z-order keeps pixels that
+    // are close together on the same few cache lines. Tiles
+    // mapped from a flat raster keep the layout of the file
+    void setTileLayout(quint16 layout);
+    quint16 tileLayout() const;
+
+    // layout of the raster, read from the database
+    RasterGrid const & grid() const;
+
+    // resolution multiplier of the refined blocks that add
+    // detail along boundaries, or 1 if the database doesn't
+    // have any; lookups against the database use the refined
+    // blocks where there are any but the flat raster only
+    // holds the base tiles
+    int refineFactor() const;
+
+    // number of tiles in the raster
+    int tileCount() const;
+
+    // bytes used by the decoded tiles in the cache
+    qint64 cachedTileBytes() const;
+
+    // admin data for an id returned by lookupId
+    AdminRegion const & region(int id) const;
+    int regionCount() const;
+
+    // get the tile and the pixel within that tile
+    // that correspond to the given coordinates
+    void getTilePixel(double lon,
+                      double lat,
+                      size_t &tile_idx,
+                      size_t &pixel_x,
+                      size_t &pixel_y) const;
+
+private:
+    struct Tile;
+    class BatchTask;
+    typedef QSharedPointer<Tile> TilePtr;
+    typedef QSharedPointer<RegionGeometry> GeometryPtr;
+
+    bool loadMeta();
+    bool loadRegions();
+    TilePtr getTile(int tile_idx, Kompex::SQLiteDatabase * database=NULL);
+    TilePtr loadTile(int tile_idx, Kompex::SQLiteDatabase * database);
+    void insertTile(TilePtr const &tile);
+    void clearCache();
+
+    // returns the id for a raw tile sample, or -1 if it
+    // isn't a region in the region table
+    int regionId(quint16 sample) const
+    {
+        return (sample < m_listRegions.size() &&
+                m_listRegions[sample].id >= 0) ? int(sample) : -1;
+    }
+
+    int sampleTile(Tile const &tile, int fine_x, int fine_y) const;
+
+    // lists the ids around a pixel that aren't id; pixels
+    // on the edge of a tile also check the tiles next to it
+    int getNeighbourIds(Tile const &tile, int fine_x, int fine_y,
+                        int id, int * listIds,
+                        Kompex::SQLiteDatabase * database);
+    int getFlatNeighbourIds(int tile_idx, uchar const * tileData,
+                            int x, int y, int id, int * listIds) const;
+    int resolveBoundary(double lon, double lat, int id,
+                        int const * listIds, int numIds,
+                        Kompex::SQLiteDatabase * database);
+    GeometryPtr getGeometry(int id, Kompex::SQLiteDatabase * database);
+
+    Kompex::SQLiteDatabase * acquireConnection();
+    void releaseConnection(Kompex::SQLiteDatabase * database);
+
+    void lookupBatch(double const * lonlat, int count, int * ids,
+                     int firstTile, Kompex::SQLiteDatabase * database);
+
+    QString m_pathDatabase;
+    FlatRaster m_flatRaster;
+
+    // how tiles are stored in the database
+    TileFormat m_tileFormat;
+    RasterGrid m_grid;
+    std::string m_tileColumn;
+    int m_refineFactor;
+    RasterGrid m_fineGrid;  // m_grid at m_refineFactor times the resolution
+
+    // order batch lookups visit tiles in with locality
+    // order and each tile's position in that order
+    bool m_localityOrder;
+    QVector<int> m_listTileOrder;
+    QVector<int> m_listTileRank;
+
+    // layout of cached block tiles
+    quint16 m_tileLayout;
+
+    // read only connections that aren't being used
+    // by any thread; m_listConnections has all of them
+    QMutex m_connectionMutex;
+    QList<Kompex::SQLiteDatabase*> m_listConnections;
+    QList<Kompex::SQLiteDatabase*> m_listFreeConnections;
+
+    QVector<AdminRegion> m_listRegions;
+    AdminRegion m_noRegion;
+
+    // tile cache; tiles are evicted using the clock
+    // algorithm so a cache hit only needs a read lock
+    mutable QReadWriteLock m_cacheLock;
+    QHash<int,TilePtr> m_tileCache;
+    QVector<int> m_clockRing;
+    int m_clockHand;
+    int m_maxCachedTiles;
+
+    // tiles that are being read in by some thread
+    QMutex m_loadMutex;
+    QWaitCondition m_loadDone;
+    QSet<int> m_loadingTiles;
+
+    // region geometry is read in the first time a lookup
+    // needs it and kept until the index is closed; regions
+    // without geometry are cached as null pointers
+    bool m_hasGeometry;
+    bool m_exactBoundaries;
+    mutable QReadWriteLock m_geometryLock;
+    QHash<int,GeometryPtr> m_geometryCache;
+};
+
+#endif // ADMINRASTERINDEX_H
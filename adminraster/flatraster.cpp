@@ -0,0 +1,323 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <cstring>
+
+// qt
+#include <QDebug>
+#include <QtEndian>
+
+#include "flatraster.h"
+#include "rastergrid.h"
+
+namespace
+{
+    char const kMagic[8] = { 'A','D','M','F','L','A','T','2' };
+    int const kHeaderSize = 24;     // magic, tile size, count, format
+}
+
+// ============================================================== //
+
+FlatRasterWriter::FlatRasterWriter() :
+    m_tileSize(0),
+    m_format(TILE_FORMAT_RAW16),
+    m_nextTile(0)
+{
+    // empty
+}
+
+FlatRasterWriter::~FlatRasterWriter()
+{
+    if(m_file.isOpen())   {
+        close();
+    }
+}
+
+bool FlatRasterWriter::open(QString const &pathFile,
+                            int tileSize,
+                            int tileCount,
+                            TileFormat format)
+{
+    if(format != TILE_FORMAT_RAW16 && format != TILE_FORMAT_BLOCK16)   {
+        qDebug() << "ERROR: Flat raster files must be raw16 or block16";
+        return false;
+    }
+
+    m_file.setFileName(pathFile);
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))   {
+        qDebug() << "ERROR: Could not open flat raster file" << pathFile;
+        return false;
+    }
+
+    m_tileSize = tileSize;
+    m_format = format;
+    m_listTileOffsets.fill(0,tileCount);
+    m_listTileSizes.fill(0,tileCount);
+    m_nextTile = 0;
+    m_pendingTiles.clear();
+
+    uchar header[kHeaderSize];
+    memcpy(header,kMagic,8);
+    qToLittleEndian<quint32>(tileSize,header+8);
+    qToLittleEndian<quint32>(tileCount,header+12);
+    qToLittleEndian<quint32>(format,header+16);
+    qToLittleEndian<quint32>(0,header+20);
+    m_file.write(reinterpret_cast<char*>(header),kHeaderSize);
+
+    // the offset table is written out on close
+    QByteArray offsetTable(tileCount*16,0);
+    return (m_file.write(offsetTable) == offsetTable.size());
+}
+
+bool FlatRasterWriter::writeTile(int tile_idx, QVector<quint16> const &ids)
+{
+    if(tile_idx < 0 || tile_idx >= m_listTileOffsets.size() ||
+       ids.size() != m_tileSize*m_tileSize)   {
+        return false;
+    }
+
+    QByteArray tileData;
+    if(m_format == TILE_FORMAT_BLOCK16)   {
+        if(!encodeBlockTile(ids,m_tileSize,tileData))   {
+            return false;
+        }
+    }
+    else if(!encodeTileIds(ids,m_tileSize,TILE_FORMAT_RAW16,tileData))   {
+        return false;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if(tile_idx != m_nextTile)   {
+        m_pendingTiles.insert(tile_idx,tileData);
+        return true;
+    }
+
+    if(!appendTile(tile_idx,tileData))   {
+        return false;
+    }
+    m_nextTile++;
+
+    // write out the tiles that were waiting on this one
+    QMap<int,QByteArray>::iterator it = m_pendingTiles.begin();
+    while(it != m_pendingTiles.end() && it.key() == m_nextTile)   {
+        if(!appendTile(it.key(),it.value()))   {
+            return false;
+        }
+        it = m_pendingTiles.erase(it);
+        m_nextTile++;
+    }
+    return true;
+}
+
+bool FlatRasterWriter::appendTile(int tile_idx, QByteArray const &tileData)
+{
+    // pad up to the next aligned offset
+    qint64 offset = m_file.size();
+    qint64 alignedOffset = (offset+kFlatRasterAlign-1)/kFlatRasterAlign*kFlatRasterAlign;
+    m_file.seek(offset);
+    if(alignedOffset > offset)   {
+        m_file.write(QByteArray(alignedOffset-offset,0));
+    }
+
+    if(m_file.write(tileData) != tileData.size())   {
+        qDebug() << "ERROR: Could not write flat raster tile" << tile_idx;
+        return false;
+    }
+    m_listTileOffsets[tile_idx] = alignedOffset;
+    m_listTileSizes[tile_idx] = tileData.size();
+    return true;
+}
+
+bool FlatRasterWriter::close()
+{
+    QMutexLocker locker(&m_mutex);
+
+    // tiles after a gap are written in order as well
+    bool ok = true;
+    QMap<int,QByteArray>::const_iterator it;
+    for(it = m_pendingTiles.constBegin(); it != m_pendingTiles.constEnd(); ++it)   {
+        ok = ok && appendTile(it.key(),it.value());
+    }
+    m_pendingTiles.clear();
+
+    QByteArray offsetTable(m_listTileOffsets.size()*16,0);
+    uchar * out = reinterpret_cast<uchar*>(offsetTable.data());
+    for(int i=0; i < m_listTileOffsets.size(); i++)   {
+        qToLittleEndian<quint64>(m_listTileOffsets[i],out+i*16);
+        qToLittleEndian<quint64>(m_listTileSizes[i],out+i*16+8);
+    }
+
+    ok = ok && m_file.seek(kHeaderSize) &&
+         (m_file.write(offsetTable) == offsetTable.size());
+
+    m_file.close();
+    return ok;
+}
+
+// ============================================================== //
+
+FlatRaster::FlatRaster() :
+    m_data(NULL),
+    m_tileSize(0),
+    m_tileCount(0),
+    m_format(TILE_FORMAT_RAW16),
+    m_listTileStates(NULL)
+{
+    // empty
+}
+
+FlatRaster::~FlatRaster()
+{
+    close();
+}
+
+bool FlatRaster::open(QString const &pathFile)
+{
+    close();
+
+#if (Q_BYTE_ORDER != Q_LITTLE_ENDIAN)
+    qDebug() << "ERROR: Flat raster files can only be"
+                "mapped on little endian hosts";
+    return false;
+#endif
+
+    m_file.setFileName(pathFile);
+    if(!m_file.open(QIODevice::ReadOnly))   {
+        qDebug() << "ERROR: Could not open flat raster file" << pathFile;
+        return false;
+    }
+
+    qint64 fileSize = m_file.size();
+    m_data = m_file.map(0,fileSize);
+    if(m_data == NULL || fileSize < kHeaderSize ||
+       memcmp(m_data,kMagic,8) != 0)   {
+        qDebug() << "ERROR: Not a flat raster file" << pathFile;
+        close();
+        return false;
+    }
+
+    quint32 tileSize = qFromLittleEndian<quint32>(m_data+8);
+    quint32 tileCount = qFromLittleEndian<quint32>(m_data+12);
+    quint32 format = qFromLittleEndian<quint32>(m_data+16);
+    if(format != TILE_FORMAT_RAW16 && format != TILE_FORMAT_BLOCK16)   {
+        qDebug() << "ERROR: Unknown flat raster tile format" << format;
+        close();
+        return false;
+    }
+    if(tileSize < quint32(kTileBlockSize) || tileSize > quint32(kGridMaxTileSize) ||
+       tileCount > quint32(kGridMaxTileCount))   {
+        qDebug() << "ERROR: Bad flat raster tile size or count"
+                 << tileSize << tileCount;
+        close();
+        return false;
+    }
+    m_tileSize = tileSize;
+    m_tileCount = tileCount;
+    m_format = TileFormat(format);
+
+    qint64 const tilesStart = kHeaderSize + qint64(m_tileCount)*16;
+    if(tilesStart > fileSize)   {
+        qDebug() << "ERROR: Truncated flat raster file" << pathFile;
+        close();
+        return false;
+    }
+
+    qint64 const rawTileBytes = qint64(m_tileSize)*m_tileSize*2;
+
+    // tiles that weren't written have an offset of 0
+    m_listTiles.fill(NULL,m_tileCount);
+    m_listTileSizes.fill(0,m_tileCount);
+    m_listTileStates = new QAtomicInt[m_tileCount];
+    for(int i=0; i < m_tileCount; i++)   {
+        uchar const * entry = m_data+kHeaderSize+qint64(i)*16;
+        quint64 offset = qFromLittleEndian<quint64>(entry);
+        quint64 size = qFromLittleEndian<quint64>(entry+8);
+        if(offset == 0)   {
+            continue;
+        }
+
+        // only the offset table is checked here; block
+        // tiles are checked in full by tileData the first
+        // time they're used since they're sampled in place
+        bool ok = (offset % 4 == 0) &&
+                  (offset >= quint64(tilesStart)) &&
+                  (size <= quint64(fileSize)) &&
+                  (offset <= quint64(fileSize)-size);
+        if(ok && m_format == TILE_FORMAT_RAW16)   {
+            ok = (qint64(size) >= rawTileBytes);
+        }
+
+        if(!ok)   {
+            qDebug() << "ERROR: Bad flat raster tile" << i;
+            close();
+            return false;
+        }
+        m_listTiles[i] = m_data+offset;
+        m_listTileSizes[i] = size;
+    }
+
+    return true;
+}
+
+uchar const * FlatRaster::checkTile(int tile_idx) const
+{
+    QAtomicInt &state = m_listTileStates[tile_idx];
+    if(state == kTileUnchecked)   {
+        bool ok = checkBlockTile(m_listTiles[tile_idx],
+                                 m_listTileSizes[tile_idx],
+                                 m_tileSize);
+
+        if(state.testAndSetOrdered(kTileUnchecked,ok ? kTileGood : kTileBad) && !ok)   {
+            qDebug() << "ERROR: Bad flat raster tile" << tile_idx;
+        }
+    }
+    return (state == kTileGood) ? m_listTiles[tile_idx] : NULL;
+}
+
+void FlatRaster::close()
+{
+    if(m_data)   {
+        m_file.unmap(m_data);
+        m_data = NULL;
+    }
+    m_file.close();
+    m_listTiles.clear();
+    m_listTileSizes.clear();
+    delete[] m_listTileStates;
+    m_listTileStates = NULL;
+    m_tileSize = 0;
+    m_tileCount = 0;
+}
+
+bool FlatRaster::isOpen() const
+{
+    return (m_data != NULL);
+}
+
+int FlatRaster::tileSize() const
+{
+    return m_tileSize;
+}
+
+int FlatRaster::tileCount() const
+{
+    return m_tileCount;
+}
+
+TileFormat FlatRaster::format() const
+{
+    return m_format;
+}
@@ -0,0 +1,162 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef FLATRASTER_H
+#define FLATRASTER_H
+
+// qt
+#include <QString>
+#include <QVector>
+#include <QFile>
+#include <QMutex>
+#include <QMap>
+#include <QAtomicInt>
+
+// adminraster
+#include "tilecodec.h"
+
+// A flat raster file holds every tile in a format that can
+// be memory mapped and sampled in place; either as a row
+// major array of little endian 16-bit admin1 ids (raw16) or
+// as an uncompressed block tile (block16). The file layout is:
+//
+// header:
+//   char[8]    magic ("ADMFLAT2")
+//   quint32    tile size (px)
+//   quint32    tile count
+//   quint32    tile format (TileFormat)
+//   quint32    reserved
+//   quint64[]  byte offset and size of each tile, one
+//              pair per tile
+// tiles:
+//   tile data; each tile starts on a kFlatRasterAlign
+//   boundary
+
+int const kFlatRasterAlign = 4096;
+
+class FlatRasterWriter
+{
+public:
+    FlatRasterWriter();
+    ~FlatRasterWriter();
+
+    // format must be TILE_FORMAT_RAW16 or TILE_FORMAT_BLOCK16
+    bool open(QString const &pathFile,
+              int tileSize,
+              int tileCount,
+              TileFormat format);
+
+    // tiles can be written in any order and from more than
+    // one thread at a time; they're held back until every
+    // tile before them has been written so the file only
+    // depends on the tiles and not on the order they came in
+    bool writeTile(int tile_idx, QVector<quint16> const &ids);
+    bool close();
+
+private:
+    // appends a tile at the next aligned offset,
+    // m_mutex must be held
+    bool appendTile(int tile_idx, QByteArray const &tileData);
+
+    QMutex m_mutex;
+    QFile m_file;
+    int m_tileSize;
+    TileFormat m_format;
+    QVector<quint64> m_listTileOffsets;
+    QVector<quint64> m_listTileSizes;
+
+    // encoded tiles waiting on a tile before them
+    int m_nextTile;
+    QMap<int,QByteArray> m_pendingTiles;
+};
+
+class FlatRaster
+{
+public:
+    FlatRaster();
+    ~FlatRaster();
+
+    bool open(QString const &pathFile);
+    void close();
+    bool isOpen() const;
+
+    int tileSize() const;
+    int tileCount() const;
+    TileFormat format() const;
+
+    // returns the data of a tile or NULL if the file
+    // doesn't have the tile or the tile is bad; block
+    // tiles are checked the first time they're used so
+    // opening the file doesn't page all of them in
+    uchar const * tileData(int tile_idx) const
+    {
+        if(tile_idx < 0 || tile_idx >= m_tileCount ||
+           m_listTiles[tile_idx] == NULL)   {
+            return NULL;
+        }
+        if(m_format == TILE_FORMAT_BLOCK16 &&
+           m_listTileStates[tile_idx] != kTileGood)   {
+            return checkTile(tile_idx);
+        }
+        return m_listTiles[tile_idx];
+    }
+
+    // returns the id of pixel (x,y) in the given tile
+    // data, which must not be NULL
+    quint16 sampleTile(uchar const * data, int x, int y) const
+    {
+        if(m_format == TILE_FORMAT_BLOCK16)   {
+            return sampleBlockTile(data,m_tileSize,x,y);
+        }
+        return qFromLittleEndian<quint16>(data + 2*(y*m_tileSize + x));
+    }
+
+    // returns true if all the neighbours of pixel (x,y) are
+    // known to have the same id as it without sampling them
+    bool isInterior(uchar const * data, int x, int y) const
+    {
+        if(m_format == TILE_FORMAT_BLOCK16)   {
+            return isBlockInterior(data,m_tileSize,x,y);
+        }
+        return false;
+    }
+
+private:
+    enum TileState
+    {
+        kTileUnchecked = 0,
+        kTileGood,
+        kTileBad
+    };
+
+    // checks a block tile that hasn't been checked yet
+    // and returns its data, or NULL if it's bad
+    uchar const * checkTile(int tile_idx) const;
+
+    QFile m_file;
+    uchar * m_data;
+    int m_tileSize;
+    int m_tileCount;
+    TileFormat m_format;
+    QVector<uchar const *> m_listTiles;
+    QVector<qint64> m_listTileSizes;
+
+    // one TileState per tile; threads that check the
+    // same tile at the same time get the same answer
+    QAtomicInt * m_listTileStates;
+};
+
+#endif // FLATRASTER_H
@@ -0,0 +1,267 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include <algorithm>
+
+#include "rastergrid.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RASTERGRID_X86 1
+#endif
+
+// The vector kernels do all of their math in doubles, which is
+// exact for pixel coordinates, and only convert to ints at the
+// end. min(int(a),b) is computed as int(min(a,b)) since a is
+// never negative for points in range, and p/tileSize is computed
+// as int((p+0.5)/tileSize) which can't round up to the next
+// integer for the sizes a grid can have
+
+namespace
+{
+    struct GridConstants
+    {
+        GridConstants(RasterGrid const &grid)
+        {
+            int const perSide = grid.tilesPerSide();
+            res = grid.resolution;
+            maxPixel = grid.hemisphereSize()-1;
+            tileSize = grid.tileSize;
+            perSideD = perSide;
+            eastTile = double(perSide)*perSide;
+        }
+
+        double res;
+        double maxPixel;
+        double tileSize;
+        double perSideD;
+        double eastTile;
+    };
+
+    void getTilePixelsScalar(RasterGrid const &grid,
+                             double const * lonlat,
+                             int count,
+                             int * tiles,
+                             quint32 * pixels)
+    {
+        for(int i=0; i < count; i++)   {
+            double lon = lonlat[i*2];
+            double lat = lonlat[i*2+1];
+            if(!(lon >= -180.0 && lon <= 180.0 && lat >= -90.0 && lat <= 90.0))   {
+                tiles[i] = -1;
+                pixels[i] = 0;
+                continue;
+            }
+
+            size_t tileIdx,pixel_x,pixel_y;
+            grid.getTilePixel(lon,lat,tileIdx,pixel_x,pixel_y);
+            tiles[i] = tileIdx;
+            pixels[i] = (pixel_y << 16) | pixel_x;
+        }
+    }
+
+#ifdef RASTERGRID_X86
+    // two points at a time; SSE2 is always there on x86-64
+    __attribute__((target("sse2")))
+    int getTilePixelsSSE2(GridConstants const &gc,
+                          double const * lonlat,
+                          int count,
+                          int * tiles,
+                          quint32 * pixels)
+    {
+        __m128d const res = _mm_set1_pd(gc.res);
+        __m128d const maxPixel = _mm_set1_pd(gc.maxPixel);
+        __m128d const tileSize = _mm_set1_pd(gc.tileSize);
+        __m128d const perSide = _mm_set1_pd(gc.perSideD);
+        __m128d const eastTile = _mm_set1_pd(gc.eastTile);
+        __m128d const half = _mm_set1_pd(0.5);
+        __m128d const zero = _mm_setzero_pd();
+        __m128d const lonMin = _mm_set1_pd(-180.0), lonMax = _mm_set1_pd(180.0);
+        __m128d const latMin = _mm_set1_pd(-90.0), latMax = _mm_set1_pd(90.0);
+        __m128d const c90 = _mm_set1_pd(90.0);
+
+        int i=0;
+        for(; i+2 <= count; i+=2)   {
+            __m128d const a = _mm_loadu_pd(lonlat+i*2);     // lon0 lat0
+            __m128d const b = _mm_loadu_pd(lonlat+i*2+2);   // lon1 lat1
+            __m128d const lon = _mm_unpacklo_pd(a,b);
+            __m128d const lat = _mm_unpackhi_pd(a,b);
+
+            __m128d valid = _mm_and_pd(_mm_cmpge_pd(lon,lonMin),_mm_cmple_pd(lon,lonMax));
+            valid = _mm_and_pd(valid,_mm_cmpge_pd(lat,latMin));
+            valid = _mm_and_pd(valid,_mm_cmple_pd(lat,latMax));
+
+            // east hemisphere points keep their lon
+            __m128d const east = _mm_cmpgt_pd(lon,zero);
+            __m128d const adjLon = _mm_add_pd(lon,_mm_andnot_pd(east,lonMax));
+            __m128d const adjTile = _mm_and_pd(east,eastTile);
+            __m128d const adjLat = _mm_sub_pd(c90,lat);
+
+            __m128d px = _mm_min_pd(_mm_mul_pd(adjLon,res),maxPixel);
+            __m128d py = _mm_min_pd(_mm_mul_pd(adjLat,res),maxPixel);
+            px = _mm_cvtepi32_pd(_mm_cvttpd_epi32(px));
+            py = _mm_cvtepi32_pd(_mm_cvttpd_epi32(py));
+
+            __m128d const col = _mm_cvtepi32_pd(_mm_cvttpd_epi32(
+                        _mm_div_pd(_mm_add_pd(px,half),tileSize)));
+            __m128d const row = _mm_cvtepi32_pd(_mm_cvttpd_epi32(
+                        _mm_div_pd(_mm_add_pd(py,half),tileSize)));
+
+            __m128d const tile = _mm_add_pd(_mm_add_pd(_mm_mul_pd(row,perSide),col),adjTile);
+            __m128i const pixelX = _mm_cvttpd_epi32(_mm_sub_pd(px,_mm_mul_pd(col,tileSize)));
+            __m128i const pixelY = _mm_cvttpd_epi32(_mm_sub_pd(py,_mm_mul_pd(row,tileSize)));
+
+            // the 64-bit lane masks become 32-bit ones
+            __m128i const mask = _mm_shuffle_epi32(_mm_castpd_si128(valid),_MM_SHUFFLE(3,3,2,0));
+            __m128i const tileIdx = _mm_or_si128(_mm_and_si128(mask,_mm_cvttpd_epi32(tile)),
+                                                 _mm_andnot_si128(mask,_mm_set1_epi32(-1)));
+            __m128i const pixel = _mm_and_si128(mask,_mm_or_si128(_mm_slli_epi32(pixelY,16),pixelX));
+
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(tiles+i),tileIdx);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(pixels+i),pixel);
+        }
+        return i;
+    }
+
+    // four points at a time
+    __attribute__((target("avx2")))
+    int getTilePixelsAVX2(GridConstants const &gc,
+                          double const * lonlat,
+                          int count,
+                          int * tiles,
+                          quint32 * pixels)
+    {
+        __m256d const res = _mm256_set1_pd(gc.res);
+        __m256d const maxPixel = _mm256_set1_pd(gc.maxPixel);
+        __m256d const tileSize = _mm256_set1_pd(gc.tileSize);
+        __m256d const perSide = _mm256_set1_pd(gc.perSideD);
+        __m256d const eastTile = _mm256_set1_pd(gc.eastTile);
+        __m256d const half = _mm256_set1_pd(0.5);
+        __m256d const zero = _mm256_setzero_pd();
+        __m256d const lonMin = _mm256_set1_pd(-180.0), lonMax = _mm256_set1_pd(180.0);
+        __m256d const latMin = _mm256_set1_pd(-90.0), latMax = _mm256_set1_pd(90.0);
+        __m256d const c90 = _mm256_set1_pd(90.0);
+
+        int i=0;
+        for(; i+4 <= count; i+=4)   {
+            __m256d const a = _mm256_loadu_pd(lonlat+i*2);     // lon0 lat0 lon1 lat1
+            __m256d const b = _mm256_loadu_pd(lonlat+i*2+4);   // lon2 lat2 lon3 lat3
+
+            // unpack gives lon0 lon2 lon1 lon3, so put
+            // the middle lanes back in order
+            __m256d const lon = _mm256_permute4x64_pd(_mm256_unpacklo_pd(a,b),_MM_SHUFFLE(3,1,2,0));
+            __m256d const lat = _mm256_permute4x64_pd(_mm256_unpackhi_pd(a,b),_MM_SHUFFLE(3,1,2,0));
+
+            __m256d valid = _mm256_and_pd(_mm256_cmp_pd(lon,lonMin,_CMP_GE_OQ),
+                                          _mm256_cmp_pd(lon,lonMax,_CMP_LE_OQ));
+            valid = _mm256_and_pd(valid,_mm256_cmp_pd(lat,latMin,_CMP_GE_OQ));
+            valid = _mm256_and_pd(valid,_mm256_cmp_pd(lat,latMax,_CMP_LE_OQ));
+
+            __m256d const east = _mm256_cmp_pd(lon,zero,_CMP_GT_OQ);
+            __m256d const adjLon = _mm256_add_pd(lon,_mm256_andnot_pd(east,lonMax));
+            __m256d const adjTile = _mm256_and_pd(east,eastTile);
+            __m256d const adjLat = _mm256_sub_pd(c90,lat);
+
+            __m256d px = _mm256_min_pd(_mm256_mul_pd(adjLon,res),maxPixel);
+            __m256d py = _mm256_min_pd(_mm256_mul_pd(adjLat,res),maxPixel);
+            px = _mm256_round_pd(px,_MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+            py = _mm256_round_pd(py,_MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+
+            __m256d const col = _mm256_round_pd(_mm256_div_pd(_mm256_add_pd(px,half),tileSize),
+                                                _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+            __m256d const row = _mm256_round_pd(_mm256_div_pd(_mm256_add_pd(py,half),tileSize),
+                                                _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+
+            __m256d const tile = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(row,perSide),col),adjTile);
+            __m128i const pixelX = _mm256_cvttpd_epi32(_mm256_sub_pd(px,_mm256_mul_pd(col,tileSize)));
+            __m128i const pixelY = _mm256_cvttpd_epi32(_mm256_sub_pd(py,_mm256_mul_pd(row,tileSize)));
+
+            // narrow the 64-bit lane masks to 32-bit ones
+            __m128i const mask = _mm256_cvtpd_epi32(_mm256_and_pd(valid,_mm256_set1_pd(-1.0)));
+            __m128i const tileIdx = _mm_or_si128(_mm_and_si128(mask,_mm256_cvttpd_epi32(tile)),
+                                                 _mm_andnot_si128(mask,_mm_set1_epi32(-1)));
+            __m128i const pixel = _mm_and_si128(mask,_mm_or_si128(_mm_slli_epi32(pixelY,16),pixelX));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(tiles+i),tileIdx);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels+i),pixel);
+        }
+        return i;
+    }
+
+    bool hasAVX2()
+    {
+        static bool const avx2 = __builtin_cpu_supports("avx2");
+        return avx2;
+    }
+#endif
+}
+
+void RasterGrid::getTilePixels(double const * lonlat,
+                               int count,
+                               int * tiles,
+                               quint32 * pixels,
+                               bool allowSimd) const
+{
+    int done = 0;
+
+#ifdef RASTERGRID_X86
+    if(allowSimd)   {
+        GridConstants gc(*this);
+        if(hasAVX2())   {
+            done = getTilePixelsAVX2(gc,lonlat,count,tiles,pixels);
+        }
+        else   {
+            done = getTilePixelsSSE2(gc,lonlat,count,tiles,pixels);
+        }
+    }
+#else
+    Q_UNUSED(allowSimd);
+#endif
+
+    // whatever's left over
+    getTilePixelsScalar(*this,lonlat+done*2,count-done,tiles+done,pixels+done);
+}
+
+void RasterGrid::getTileCurveOrder(QVector<int> &listTiles) const
+{
+    int const perSide = tilesPerSide();
+    int const hemTiles = perSide*perSide;
+
+    // sort each hemisphere's tiles by (code << 32 | tile)
+    QVector<quint64> listKeys(hemTiles);
+    for(int t=0; t < hemTiles; t++)   {
+        quint64 code = mortonCode(t % perSide,t / perSide);
+        listKeys[t] = (code << 32) | quint64(t);
+    }
+    std::sort(listKeys.begin(),listKeys.end());
+
+    listTiles.resize(2*hemTiles);
+    for(int h=0; h < 2; h++)   {
+        for(int i=0; i < hemTiles; i++)   {
+            listTiles[h*hemTiles + i] = h*hemTiles + int(listKeys[i] & 0xFFFFFFFF);
+        }
+    }
+}
+
+char const * RasterGrid::simdName()
+{
+#ifdef RASTERGRID_X86
+    return hasAVX2() ? "avx2" : "sse2";
+#else
+    return "none";
+#endif
+}
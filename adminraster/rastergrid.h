@@ -0,0 +1,194 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef RASTERGRID_H
+#define RASTERGRID_H
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+
+// qt
+#include <QtGlobal>
+#include <QVector>
+
+// tilecodec
+#include "tilecodec.h"
+
+// The raster is split into a west and an east hemisphere,
+// each (180*resolution)px square, and each hemisphere is
+// split into tilesPerSide x tilesPerSide square tiles that
+// are numbered row major, west hemisphere first. Tiles on
+// the right and bottom edges can hang over the edge of the
+// hemisphere; those pixels are never sampled.
+// Databases without a resolution or tile size in their
+// meta table use the defaults below
+int const kGridDefaultResolution = 100;    // px/degree
+int const kGridDefaultTileSize = 1000;     // px
+int const kGridMaxResolution = 3600;
+int const kGridMaxTileSize = 4096;
+
+// the index keeps a few bytes per tile (visiting order,
+// batch buckets, flat raster offsets) so the number of
+// tiles is capped well below what fits in an int
+int const kGridMaxTileCount = 1 << 22;
+
+struct RasterGrid
+{
+    RasterGrid(int res=kGridDefaultResolution,
+               int size=kGridDefaultTileSize) :
+        resolution(res),
+        tileSize(size)
+    {}
+
+    // tile sizes have to be a multiple of the block
+    // size so tiles can be stored as block tiles
+    bool isValid() const
+    {
+        return (resolution >= 1 && resolution <= kGridMaxResolution &&
+                tileSize >= kTileBlockSize && tileSize <= kGridMaxTileSize &&
+                tileSize % kTileBlockSize == 0 && isIndexable());
+    }
+
+    // true if lookups can address every pixel of the grid:
+    // pixel coordinates within a tile fit in 16 bits, the
+    // raster is less than 2^31 pixels wide and there are at
+    // most kGridMaxTileCount tiles. Refined grids go past the
+    // limits of isValid but still have to pass this
+    bool isIndexable() const
+    {
+        if(resolution < 1 || tileSize < 1 || tileSize > 0x10000 ||
+           qint64(360)*resolution > std::numeric_limits<int>::max())   {
+            return false;
+        }
+        qint64 const perSide = (qint64(180)*resolution+tileSize-1)/tileSize;
+        return (2*perSide*perSide <= kGridMaxTileCount);
+    }
+
+    int hemisphereSize() const
+    {   return 180*resolution;   }
+
+    int tilesPerSide() const
+    {   return (hemisphereSize()+tileSize-1)/tileSize;   }
+
+    int tileCount() const
+    {   return 2*tilesPerSide()*tilesPerSide();   }
+
+    // position of the top left corner of a tile in
+    // pixels; the east hemisphere starts at x=180*res
+    void getTileOrigin(int tile_idx, int &x, int &y) const
+    {
+        int const perSide = tilesPerSide();
+        int hemisphere = tile_idx/(perSide*perSide);
+        int row = (tile_idx/perSide) % perSide;
+        int col = tile_idx % perSide;
+        x = hemisphere*hemisphereSize() + col*tileSize;
+        y = row*tileSize;
+    }
+
+    // get the tile and the pixel within that tile of
+    // pixel (x,y) of tile_idx, where (x,y) can be outside
+    // of tile_idx; wraps around at lon ±180 and returns
+    // false for pixels past the poles
+    bool getNeighbourPixel(int tile_idx, int x, int y,
+                           int &nTile_idx, int &nx, int &ny) const
+    {
+        int const perSide = tilesPerSide();
+        int const hemSize = hemisphereSize();
+
+        int gx,gy;
+        getTileOrigin(tile_idx,gx,gy);
+        gx += x;
+        gy += y;
+        if(gy < 0 || gy >= hemSize)   {
+            return false;
+        }
+        if(gx < 0)   {
+            gx += 2*hemSize;
+        }
+        else if(gx >= 2*hemSize)   {
+            gx -= 2*hemSize;
+        }
+
+        int hemisphere = gx/hemSize;
+        int px = gx - hemisphere*hemSize;
+        int row = gy/tileSize;
+        int col = px/tileSize;
+        nTile_idx = hemisphere*perSide*perSide + row*perSide + col;
+        nx = px - col*tileSize;
+        ny = gy - row*tileSize;
+        return true;
+    }
+
+    // get the tile and the pixel within that tile
+    // that correspond to the given coordinates
+    void getTilePixel(double lon,
+                      double lat,
+                      size_t &tile_idx,
+                      size_t &pixel_x,
+                      size_t &pixel_y) const
+    {
+        int const perSide = tilesPerSide();
+        int const hemSize = hemisphereSize();
+
+        size_t adjTile = 0;
+        double adjLon = lon + 180.0;
+        double adjLat = (lat-90.0)*-1.0;
+        if(lon > 0.0)   {
+            adjTile = perSide*perSide;
+            adjLon = lon;
+        }
+
+        // lon 0/180 and lat -90 land exactly on the far
+        // edge of a hemisphere so clamp them to its last
+        // row and column of pixels
+        size_t px = std::min(int(adjLon*resolution),hemSize-1);
+        size_t py = std::min(int(adjLat*resolution),hemSize-1);
+
+        size_t rowIdx = py/tileSize;
+        size_t colIdx = px/tileSize;
+
+        tile_idx = (rowIdx*perSide + colIdx) + adjTile;
+        pixel_x = px - colIdx*tileSize;
+        pixel_y = py - rowIdx*tileSize;
+    }
+
+    // batch version of getTilePixel for count interleaved
+    // lon,lat pairs; tiles receives the tile of each point, or
+    // -1 if it's outside [-180,180] x [-90,90], and pixels
+    // receives (pixel_y << 16) | pixel_x. Runs 4 points at a
+    // time with AVX2 or 2 at a time with SSE2 when the cpu has
+    // them (unless allowSimd is false) and gives exactly the
+    // same results as getTilePixel
+    void getTilePixels(double const * lonlat,
+                       int count,
+                       int * tiles,
+                       quint32 * pixels,
+                       bool allowSimd=true) const;
+
+    // lists every tile in Z-order of its row and column,
+    // the west hemisphere first, so tiles that are next to
+    // each other are mostly next to each other in the list
+    void getTileCurveOrder(QVector<int> &listTiles) const;
+
+    // name of the instruction set getTilePixels uses
+    static char const * simdName();
+
+    int resolution;     // px/degree
+    int tileSize;       // px
+};
+
+#endif // RASTERGRID_H
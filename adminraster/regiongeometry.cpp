@@ -0,0 +1,275 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// qt
+#include <QtEndian>
+
+#include "regiongeometry.h"
+
+namespace
+{
+    // average number of edges per band
+    int const kEdgesPerBand = 8;
+    int const kMaxBands = 4096;
+
+    // limits for rows that are read in; coordinates are in
+    // raster degrees and an edge is counted once per band
+    double const kMaxCoordinate = 1000.0;
+    qint64 const kMaxBandEdges = 1 << 26;
+
+    // heights (as a fraction of the ring's height) of the
+    // scanlines tried by getPointInRing; later ones are only
+    // used if the earlier ones just graze the ring
+    double const kScanlines[] = { 0.5, 0.25, 0.75, 0.125, 0.375, 0.625, 0.875 };
+    int const kNumScanlines = sizeof(kScanlines)/sizeof(kScanlines[0]);
+}
+
+bool encodeRegionGeometry(QVector<double> const &listX,
+                          QVector<double> const &listY,
+                          QVector<int> const &listRingStart,
+                          QByteArray &data)
+{
+    int const numRings = listRingStart.size()-1;
+    if(numRings < 1 || listX.size() != listY.size() ||
+       listRingStart.last() > listX.size())   {
+        return false;
+    }
+
+    int const numVertices = listRingStart.last()-listRingStart.first();
+    QByteArray rowData(4 + numRings*4 + numVertices*16,0);
+    uchar * out = reinterpret_cast<uchar*>(rowData.data());
+
+    qToLittleEndian<quint32>(numRings,out);
+    out += 4;
+    for(int i=0; i < numRings; i++)   {
+        qToLittleEndian<quint32>(listRingStart[i+1]-listRingStart[i],out);
+        out += 4;
+    }
+
+    // doubles are written as their bit patterns
+    for(int i=listRingStart.first(); i < listRingStart.last(); i++)   {
+        quint64 bits;
+        memcpy(&bits,&listX[i],8);
+        qToLittleEndian<quint64>(bits,out);
+        memcpy(&bits,&listY[i],8);
+        qToLittleEndian<quint64>(bits,out+8);
+        out += 16;
+    }
+
+    data = qCompress(rowData);
+    return true;
+}
+
+bool getPointInRing(double const * listX,
+                    double const * listY,
+                    int count,
+                    double &x, double &y)
+{
+    if(count < 3)   {
+        return false;
+    }
+
+    double minY = listY[0];
+    double maxY = listY[0];
+    for(int i=1; i < count; i++)   {
+        minY = std::min(minY,listY[i]);
+        maxY = std::max(maxY,listY[i]);
+    }
+    if(!(maxY > minY))   {
+        return false;
+    }
+
+    double const inf = std::numeric_limits<double>::infinity();
+    for(int s=0; s < kNumScanlines; s++)   {
+        double const sy = minY + (maxY-minY)*kScanlines[s];
+
+        // keep the two leftmost crossings of the scanline;
+        // the span between them is inside the ring
+        double x1 = inf;
+        double x2 = inf;
+        for(int i=0, j=count-1; i < count; j=i++)   {
+            double const ay = listY[j];
+            double const by = listY[i];
+            bool const crosses = ((ay <= sy) != (by <= sy));
+            double const dy = crosses ? (by-ay) : 1.0;
+            double const cx = crosses ?
+                        listX[j] + (sy-ay)*(listX[i]-listX[j])/dy : inf;
+
+            double const lo = std::min(x1,cx);
+            x2 = std::min(x2,std::max(x1,cx));
+            x1 = lo;
+        }
+
+        if(x2 > x1 && x2 < inf)   {
+            x = (x1+x2)*0.5;
+            y = sy;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// ============================================================== //
+
+RegionGeometry::RegionGeometry() :
+    m_minX(0),m_minY(0),
+    m_maxX(-1),m_maxY(-1),
+    m_bandHeight(1),
+    m_numBands(0)
+{
+    // empty
+}
+
+bool RegionGeometry::decode(QByteArray const &data)
+{
+    QByteArray rowData = qUncompress(data);
+    uchar const * in = reinterpret_cast<uchar const *>(rowData.constData());
+    if(rowData.size() < 4)   {
+        return false;
+    }
+
+    qint64 const numRings = qFromLittleEndian<quint32>(in);
+    if(rowData.size() < 4 + numRings*4)   {
+        return false;
+    }
+
+    // every ring has to fit in what's left of the row
+    // before it's added up, so bad sizes can't wrap
+    qint64 const maxVertices = (rowData.size() - 4 - numRings*4)/16;
+    QVector<int> listRingSizes(numRings);
+    qint64 numVertices = 0;
+    for(int i=0; i < numRings; i++)   {
+        qint64 ringSize = qFromLittleEndian<quint32>(in+4+i*4);
+        if(ringSize > maxVertices-numVertices)   {
+            return false;
+        }
+        listRingSizes[i] = int(ringSize);
+        numVertices += ringSize;
+    }
+    if(rowData.size() != 4 + numRings*4 + numVertices*16)   {
+        return false;
+    }
+
+    // coordinates that aren't finite would
+    // break the band math below
+    QVector<double> listXY(numVertices*2);
+    uchar const * vx = in + 4 + numRings*4;
+    for(qint64 i=0; i < numVertices*2; i++)   {
+        quint64 bits = qFromLittleEndian<quint64>(vx+i*8);
+        memcpy(&listXY[i],&bits,8);
+        if(!(std::fabs(listXY[i]) <= kMaxCoordinate))   {
+            return false;
+        }
+    }
+
+    // bounding box
+    m_minX = m_minY = 1E9;
+    m_maxX = m_maxY = -1E9;
+    for(qint64 i=0; i < numVertices; i++)   {
+        m_minX = std::min(m_minX,listXY[i*2]);
+        m_maxX = std::max(m_maxX,listXY[i*2]);
+        m_minY = std::min(m_minY,listXY[i*2+1]);
+        m_maxY = std::max(m_maxY,listXY[i*2+1]);
+    }
+
+    m_numBands = std::max(1,std::min(int(numVertices/kEdgesPerBand),kMaxBands));
+    m_bandHeight = (m_maxY > m_minY) ? (m_maxY-m_minY)/m_numBands : 1.0;
+
+    // count the edges in each band; horizontal edges
+    // never change the winding number so they're dropped
+    QVector<int> listBandCount(m_numBands+1,0);
+    for(int pass=0; pass < 2; pass++)   {
+        qint64 ringStart = 0;
+        for(int r=0; r < numRings; r++)   {
+            int const n = listRingSizes[r];
+            for(int i=0; i < n; i++)   {
+                double const * a = &listXY[(ringStart+i)*2];
+                double const * b = &listXY[(ringStart+(i+1)%n)*2];
+                if(a[1] == b[1])   {
+                    continue;
+                }
+
+                int bFirst = std::min(int((std::min(a[1],b[1])-m_minY)/m_bandHeight),m_numBands-1);
+                int bLast = std::min(int((std::max(a[1],b[1])-m_minY)/m_bandHeight),m_numBands-1);
+                for(int band=bFirst; band <= bLast; band++)   {
+                    if(pass == 0)   {
+                        listBandCount[band+1]++;
+                    }
+                    else   {
+                        double * edge = &m_listEdges[4*(listBandCount[band]++)];
+                        edge[0] = a[0]; edge[1] = a[1];
+                        edge[2] = b[0]; edge[3] = b[1];
+                    }
+                }
+            }
+            ringStart += n;
+        }
+
+        if(pass == 0)   {
+            qint64 numEdges = 0;
+            for(int band=0; band < m_numBands; band++)   {
+                numEdges += listBandCount[band+1];
+                if(numEdges > kMaxBandEdges)   {
+                    return false;
+                }
+                listBandCount[band+1] += listBandCount[band];
+            }
+            m_listBandStart = listBandCount;
+            m_listEdges.resize(4*listBandCount[m_numBands]);
+        }
+    }
+
+    return true;
+}
+
+bool RegionGeometry::contains(double x, double y) const
+{
+    if(!(x >= m_minX && x <= m_maxX && y >= m_minY && y <= m_maxY))   {
+        return false;
+    }
+
+    int band = std::min(int((y-m_minY)/m_bandHeight),m_numBands-1);
+    double const * edge = m_listEdges.constData() + 4*m_listBandStart[band];
+    double const * edgeEnd = m_listEdges.constData() + 4*m_listBandStart[band+1];
+
+    // nonzero winding rule; an edge counts if it crosses
+    // the horizontal line through the point (half open in
+    // y so shared vertices aren't counted twice) on the
+    // side given by the sign of the cross product
+    int winding = 0;
+    for(; edge != edgeEnd; edge += 4)   {
+        double const x1 = edge[0], y1 = edge[1];
+        double const x2 = edge[2], y2 = edge[3];
+        double const side = (x2-x1)*(y-y1) - (x-x1)*(y2-y1);
+        winding += int(y1 <= y && y2 > y && side > 0) -
+                   int(y1 > y && y2 <= y && side < 0);
+    }
+
+    return (winding != 0);
+}
+
+qint64 RegionGeometry::byteSize() const
+{
+    return qint64(m_listEdges.size())*sizeof(double) +
+           qint64(m_listBandStart.size())*sizeof(int);
+}
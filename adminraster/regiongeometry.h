@@ -0,0 +1,90 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef REGIONGEOMETRY_H
+#define REGIONGEOMETRY_H
+
+// qt
+#include <QVector>
+#include <QByteArray>
+
+// The geometry table of adminraster.sqlite optionally holds
+// the (simplified) rings of each admin1 region so lookups
+// that land on a boundary pixel can be checked against the
+// actual polygons. Coordinates are in degrees with the same
+// orientation as the raster: x = lon+180, y = 90-lat. A row
+// is zlib compressed and holds little endian values:
+//
+//   quint32    number of rings
+//   quint32[]  number of vertices in each ring
+//   double[]   x,y pairs of the vertices of every ring,
+//              one ring after the other
+//
+// Rings are implicitly closed and are filled with the
+// nonzero winding rule, the same as the rasterizer, so
+// holes are rings wound the other way
+
+// builds a geometry row out of rings stored in flat arrays;
+// ring i has the vertices [listRingStart[i],listRingStart[i+1])
+bool encodeRegionGeometry(QVector<double> const &listX,
+                          QVector<double> const &listY,
+                          QVector<int> const &listRingStart,
+                          QByteArray &data);
+
+// finds a point inside a ring given as count vertices in
+// contiguous arrays; the point is the midpoint of the first
+// span a horizontal scanline through the ring crosses, so it
+// takes a single pass over the edges per scanline tried and
+// doesn't allocate. Used for the label points of regions.
+// Returns false if the ring is degenerate
+bool getPointInRing(double const * listX,
+                    double const * listY,
+                    int count,
+                    double &x, double &y);
+
+// A decoded region that can answer point in polygon
+// queries. Edges are bucketed into horizontal bands
+// over the region's bounding box so a query only
+// visits the edges that cross the point's band
+class RegionGeometry
+{
+public:
+    RegionGeometry();
+
+    bool decode(QByteArray const &data);
+
+    // x and y are in raster degrees (see above)
+    bool contains(double x, double y) const;
+
+    // bytes used by the decoded edges
+    qint64 byteSize() const;
+
+private:
+    double m_minX;
+    double m_minY;
+    double m_maxX;
+    double m_maxY;
+    double m_bandHeight;
+    int m_numBands;
+
+    // x1,y1,x2,y2 of each edge, grouped by band; band b has
+    // the edges [m_listBandStart[b],m_listBandStart[b+1])
+    QVector<double> m_listEdges;
+    QVector<int> m_listBandStart;
+};
+
+#endif // REGIONGEOMETRY_H
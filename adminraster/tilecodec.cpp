@@ -0,0 +1,557 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <algorithm>
+
+// qt
+#include <QBuffer>
+#include <QHash>
+#include <QImageWriter>
+#include <QtEndian>
+
+#include "tilecodec.h"
+
+QString tileFormatName(TileFormat format)
+{
+    switch(format)   {
+        case TILE_FORMAT_PNG:   return "png";
+        case TILE_FORMAT_RAW16: return "raw16";
+        case TILE_FORMAT_RLE16: return "rle16";
+        case TILE_FORMAT_BLOCK16: return "block16";
+    }
+    return QString();
+}
+
+bool tileFormatFromName(QString const &name, TileFormat &format)
+{
+    if(name == "png")   {
+        format = TILE_FORMAT_PNG;
+    }
+    else if(name == "raw16")   {
+        format = TILE_FORMAT_RAW16;
+    }
+    else if(name == "rle16")   {
+        format = TILE_FORMAT_RLE16;
+    }
+    else if(name == "block16")   {
+        format = TILE_FORMAT_BLOCK16;
+    }
+    else   {
+        return false;
+    }
+    return true;
+}
+
+void tileImageToIds(QImage const &image,
+                    QVector<quint16> &ids)
+{
+    QImage img = image.convertToFormat(QImage::Format_RGB32);
+    int const width = img.width();
+    int const height = img.height();
+
+    ids.resize(width*height);
+    quint16 * id = ids.data();
+
+    for(int y=0; y < height; y++)   {
+        QRgb const * line = reinterpret_cast<QRgb const *>(
+                    img.constScanLine(y));
+
+        for(int x=0; x < width; x++)   {
+            // anything that doesn't fit into
+            // 16 bits (ie. white) has no region
+            quint32 color = line[x] & 0xFFFFFF;
+            *id++ = (color < kTileNoRegion) ? quint16(color) : kTileNoRegion;
+        }
+    }
+}
+
+namespace
+{
+    // gathers the even bits of a morton code back
+    // into a coordinate, the inverse of mortonCode
+    int mortonCompact(quint32 code)
+    {
+        code &= 0x55555555;
+        code = (code | (code >> 1)) & 0x33333333;
+        code = (code | (code >> 2)) & 0x0F0F0F0F;
+        code = (code | (code >> 4)) & 0x00FF00FF;
+        code = (code | (code >> 8)) & 0x0000FFFF;
+        return int(code);
+    }
+
+    QRgb idToColor(quint16 id)
+    {
+        // no region is painted white
+        return (id == kTileNoRegion) ? qRgb(255,255,255) : (0xFF000000 | id);
+    }
+
+    // builds an 8-bit palette image of the ids if there
+    // are few enough of them, returns false otherwise
+    bool idsToIndexedImage(quint16 const * id,
+                           int tileSize,
+                           QImage &img)
+    {
+        int const numPixels = tileSize*tileSize;
+
+        QHash<quint16,int> tableIndex;
+        QVector<QRgb> listColors;
+        for(int i=0; i < numPixels; i++)   {
+            if(i > 0 && id[i] == id[i-1])   {
+                continue;
+            }
+            if(!tableIndex.contains(id[i]))   {
+                if(listColors.size() == 256)   {
+                    return false;
+                }
+                tableIndex.insert(id[i],listColors.size());
+                listColors.push_back(idToColor(id[i]));
+            }
+        }
+
+        img = QImage(tileSize,tileSize,QImage::Format_Indexed8);
+        img.setColorTable(listColors);
+
+        quint16 lastId = id[0];
+        uchar lastIndex = tableIndex.value(lastId);
+        for(int y=0; y < tileSize; y++)   {
+            uchar * line = img.scanLine(y);
+            for(int x=0; x < tileSize; x++)   {
+                if(*id != lastId)   {
+                    lastId = *id;
+                    lastIndex = tableIndex.value(lastId);
+                }
+                line[x] = lastIndex;
+                id++;
+            }
+        }
+        return true;
+    }
+}
+
+bool encodeTileIds(QVector<quint16> const &ids,
+                   int tileSize,
+                   TileFormat format,
+                   QByteArray &data,
+                   int effort)
+{
+    int const numPixels = tileSize*tileSize;
+    if(ids.size() != numPixels)   {
+        return false;
+    }
+    quint16 const * id = ids.constData();
+
+    data.clear();
+
+    if(format == TILE_FORMAT_PNG)   {
+        QImage img;
+        if(effort == kTileEffortDefault || !idsToIndexedImage(id,tileSize,img))   {
+            img = QImage(tileSize,tileSize,QImage::Format_RGB888);
+            for(int y=0; y < tileSize; y++)   {
+                uchar * line = img.scanLine(y);
+                for(int x=0; x < tileSize; x++)   {
+                    QRgb color = idToColor(*id++);
+                    line[x*3+0] = qRed(color);
+                    line[x*3+1] = qGreen(color);
+                    line[x*3+2] = qBlue(color);
+                }
+            }
+        }
+
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        QImageWriter writer(&buffer,"PNG");
+        if(effort != kTileEffortDefault)   {
+            // qt maps quality [100,0] onto zlib levels [0,9]
+            effort = qBound(0,effort,9);
+            writer.setQuality(100 - (effort*91+8)/9);
+        }
+        return writer.write(img);
+    }
+    else if(format == TILE_FORMAT_RAW16)   {
+        data.resize(numPixels*2);
+        uchar * out = reinterpret_cast<uchar*>(data.data());
+        for(int i=0; i < numPixels; i++)   {
+            qToLittleEndian<quint16>(id[i],out+i*2);
+        }
+        return true;
+    }
+    else if(format == TILE_FORMAT_RLE16)   {
+        int i=0;
+        while(i < numPixels)   {
+            quint16 runId = id[i];
+            int runEnd = i+1;
+            while(runEnd < numPixels &&
+                  id[runEnd] == runId &&
+                  runEnd-i < 0xFFFF)   {
+                runEnd++;
+            }
+
+            uchar run[4];
+            qToLittleEndian<quint16>(quint16(runEnd-i),run);
+            qToLittleEndian<quint16>(runId,run+2);
+            data.append(reinterpret_cast<char*>(run),4);
+            i = runEnd;
+        }
+        return true;
+    }
+    else if(format == TILE_FORMAT_BLOCK16)   {
+        QByteArray blockData;
+        if(!encodeBlockTile(ids,tileSize,blockData))   {
+            return false;
+        }
+        if(effort == kTileEffortDefault)   {
+            effort = 9;
+        }
+        data = qCompress(blockData,qBound(0,effort,9));
+        return true;
+    }
+
+    return false;
+}
+
+bool decodeTileIds(QByteArray const &data,
+                   int tileSize,
+                   TileFormat format,
+                   QVector<quint16> &ids)
+{
+    int const numPixels = tileSize*tileSize;
+    uchar const * in = reinterpret_cast<uchar const *>(data.constData());
+
+    if(format == TILE_FORMAT_PNG)   {
+        QImage img = QImage::fromData(data,"PNG");
+        if(img.width() != tileSize || img.height() != tileSize)   {
+            return false;
+        }
+        tileImageToIds(img,ids);
+        return true;
+    }
+    else if(format == TILE_FORMAT_RAW16)   {
+        if(data.size() != numPixels*2)   {
+            return false;
+        }
+        ids.resize(numPixels);
+        quint16 * id = ids.data();
+        for(int i=0; i < numPixels; i++)   {
+            id[i] = qFromLittleEndian<quint16>(in+i*2);
+        }
+        return true;
+    }
+    else if(format == TILE_FORMAT_RLE16)   {
+        ids.resize(numPixels);
+        quint16 * id = ids.data();
+
+        int i=0;
+        int const numRuns = data.size()/4;
+        for(int r=0; r < numRuns; r++)   {
+            int runLength = qFromLittleEndian<quint16>(in+r*4);
+            quint16 runId = qFromLittleEndian<quint16>(in+r*4+2);
+            if(i+runLength > numPixels)   {
+                return false;
+            }
+            std::fill(id+i,id+i+runLength,runId);
+            i += runLength;
+        }
+        return (i == numPixels);
+    }
+    else if(format == TILE_FORMAT_BLOCK16)   {
+        return decodeBlockTile(qUncompress(data),tileSize,ids);
+    }
+
+    return false;
+}
+
+bool encodeBlockTile(QVector<quint16> const &ids,
+                     int tileSize,
+                     QByteArray &data,
+                     quint16 layout)
+{
+    if(tileSize % kTileBlockSize != 0 || ids.size() != tileSize*tileSize ||
+       (layout != kTileBlockRowMajor && layout != kTileBlockZOrder))   {
+        return false;
+    }
+    quint16 const * id = ids.constData();
+    int const numPixels = tileSize*tileSize;
+
+    data.clear();
+
+    // uniform tile
+    if(std::count(id,id+numPixels,id[0]) == numPixels)   {
+        data.resize(kTileBlockHeaderSize);
+        uchar * out = reinterpret_cast<uchar*>(data.data());
+        qToLittleEndian<quint16>(0,out);
+        qToLittleEndian<quint16>(id[0],out+2);
+        return true;
+    }
+
+    int const blocksPerSide = tileSize/kTileBlockSize;
+    int const blockPixels = kTileBlockSize*kTileBlockSize;
+
+    // slots in a z-order table that are past the edge
+    // of the tile stay as uniform blocks with no region
+    QVector<quint32> listTable(blockTableSize(blocksPerSide,layout),
+                               kTileBlockUniform | kTileNoRegion);
+    QVector<quint16> listPool;
+    quint16 block[kTileBlockSize*kTileBlockSize];
+
+    // blocks are visited in table order so the pool
+    // blocks end up in the same order as the table
+    for(int t=0; t < listTable.size(); t++)   {
+        int bx = t % blocksPerSide;
+        int by = t / blocksPerSide;
+        if(layout == kTileBlockZOrder)   {
+            bx = mortonCompact(t);
+            by = mortonCompact(t >> 1);
+            if(bx >= blocksPerSide || by >= blocksPerSide)   {
+                continue;
+            }
+        }
+
+        // copy out the block
+        for(int y=0; y < kTileBlockSize; y++)   {
+            quint16 const * line = id +
+                    (by*kTileBlockSize + y)*tileSize + bx*kTileBlockSize;
+            for(int x=0; x < kTileBlockSize; x++)   {
+                block[blockPixelIndex(x,y,layout)] = line[x];
+            }
+        }
+
+        quint32 &entry = listTable[t];
+        if(std::count(block,block+blockPixels,block[0]) == blockPixels)   {
+            entry = kTileBlockUniform | block[0];
+        }
+        else   {
+            entry = listPool.size()/blockPixels;
+            for(int i=0; i < blockPixels; i++)   {
+                listPool.push_back(block[i]);
+            }
+        }
+    }
+
+    data.resize(kTileBlockHeaderSize + listTable.size()*4 + listPool.size()*2);
+    uchar * out = reinterpret_cast<uchar*>(data.data());
+    qToLittleEndian<quint16>(kTileBlockSize,out);
+    qToLittleEndian<quint16>(layout,out+2);
+    out += kTileBlockHeaderSize;
+
+    for(int i=0; i < listTable.size(); i++)   {
+        qToLittleEndian<quint32>(listTable[i],out);
+        out += 4;
+    }
+    for(int i=0; i < listPool.size(); i++)   {
+        qToLittleEndian<quint16>(listPool[i],out);
+        out += 2;
+    }
+
+    return true;
+}
+
+bool checkBlockTile(uchar const * data, qint64 size, int tileSize)
+{
+    if(size < kTileBlockHeaderSize)   {
+        return false;
+    }
+    if(qFromLittleEndian<quint16>(data) == 0)   {
+        return true;
+    }
+
+    quint16 const layout = qFromLittleEndian<quint16>(data+2);
+    if(qFromLittleEndian<quint16>(data) != kTileBlockSize ||
+       tileSize < kTileBlockSize || tileSize % kTileBlockSize != 0 ||
+       (layout != kTileBlockRowMajor && layout != kTileBlockZOrder))   {
+        return false;
+    }
+
+    // the table has to fit before the pool is sized
+    qint64 const tableSize = blockTableSize(tileSize/kTileBlockSize,layout);
+    qint64 const poolBytes = size - kTileBlockHeaderSize - tableSize*4;
+    int const blockBytes = kTileBlockSize*kTileBlockSize*2;
+    if(poolBytes < 0 || poolBytes % blockBytes != 0)   {
+        return false;
+    }
+    qint64 const poolBlocks = poolBytes/blockBytes;
+
+    uchar const * table = data + kTileBlockHeaderSize;
+    for(qint64 i=0; i < tableSize; i++)   {
+        quint32 entry = qFromLittleEndian<quint32>(table+4*i);
+        if(!(entry & kTileBlockUniform) && entry >= poolBlocks)   {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool decodeBlockTile(QByteArray const &data,
+                     int tileSize,
+                     QVector<quint16> &ids)
+{
+    uchar const * in = reinterpret_cast<uchar const *>(data.constData());
+    if(!checkBlockTile(in,data.size(),tileSize))   {
+        return false;
+    }
+    int const numPixels = tileSize*tileSize;
+
+    if(qFromLittleEndian<quint16>(in) == 0)   {
+        ids.fill(qFromLittleEndian<quint16>(in+2),numPixels);
+        return true;
+    }
+
+    quint16 const layout = qFromLittleEndian<quint16>(in+2);
+    int const blocksPerSide = tileSize/kTileBlockSize;
+    int const blockPixels = kTileBlockSize*kTileBlockSize;
+    int const tableSize = blockTableSize(blocksPerSide,layout);
+
+    ids.resize(numPixels);
+    quint16 * id = ids.data();
+    uchar const * table = in + kTileBlockHeaderSize;
+    uchar const * pool = table + tableSize*4;
+
+    for(int by=0; by < blocksPerSide; by++)   {
+        for(int bx=0; bx < blocksPerSide; bx++)   {
+            quint32 entry = qFromLittleEndian<quint32>(
+                        table + 4*blockTableIndex(bx,by,blocksPerSide,layout));
+
+            bool uniform = (entry & kTileBlockUniform);
+            uchar const * poolBlock = uniform ? NULL :
+                    pool + 2*qint64(entry)*blockPixels;
+            for(int y=0; y < kTileBlockSize; y++)   {
+                quint16 * line = id +
+                        (by*kTileBlockSize + y)*tileSize + bx*kTileBlockSize;
+
+                if(uniform)   {
+                    std::fill(line,line+kTileBlockSize,quint16(entry));
+                    continue;
+                }
+
+                for(int x=0; x < kTileBlockSize; x++)   {
+                    line[x] = qFromLittleEndian<quint16>(
+                                poolBlock + 2*blockPixelIndex(x,y,layout));
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+bool encodeRefinedTile(QVector<quint32> const &listBlockIds,
+                       QVector<quint16> const &listFineIds,
+                       int factor,
+                       QByteArray &data)
+{
+    int const fineBlockSize = kTileBlockSize*factor;
+    int const fineBlockPixels = fineBlockSize*fineBlockSize;
+    int const numBlocks = listBlockIds.size();
+    if(factor < 2 || factor > kTileRefineMaxFactor ||
+       listFineIds.size() != numBlocks*fineBlockPixels)   {
+        return false;
+    }
+
+    int const blockPixels = kTileBlockSize*kTileBlockSize;
+    QVector<quint32> listTable(numBlocks*factor*factor);
+    QVector<quint16> listPool;
+    quint16 block[kTileBlockSize*kTileBlockSize];
+
+    for(int b=0; b < numBlocks; b++)   {
+        quint16 const * fineIds = listFineIds.constData() + b*fineBlockPixels;
+
+        for(int sy=0; sy < factor; sy++)   {
+            for(int sx=0; sx < factor; sx++)   {
+                // copy out the fine block
+                for(int y=0; y < kTileBlockSize; y++)   {
+                    quint16 const * line = fineIds +
+                            (sy*kTileBlockSize + y)*fineBlockSize + sx*kTileBlockSize;
+                    std::copy(line,line+kTileBlockSize,block+y*kTileBlockSize);
+                }
+
+                quint32 &entry = listTable[(b*factor + sy)*factor + sx];
+                if(std::count(block,block+blockPixels,block[0]) == blockPixels)   {
+                    entry = kTileBlockUniform | block[0];
+                }
+                else   {
+                    entry = listPool.size()/blockPixels;
+                    for(int i=0; i < blockPixels; i++)   {
+                        listPool.push_back(block[i]);
+                    }
+                }
+            }
+        }
+    }
+
+    data.resize(kTileRefineHeaderSize + numBlocks*4 +
+                listTable.size()*4 + listPool.size()*2);
+    uchar * out = reinterpret_cast<uchar*>(data.data());
+    qToLittleEndian<quint16>(factor,out);
+    qToLittleEndian<quint16>(0,out+2);
+    qToLittleEndian<quint32>(numBlocks,out+4);
+    out += kTileRefineHeaderSize;
+
+    for(int i=0; i < numBlocks; i++)   {
+        qToLittleEndian<quint32>(listBlockIds[i],out);
+        out += 4;
+    }
+    for(int i=0; i < listTable.size(); i++)   {
+        qToLittleEndian<quint32>(listTable[i],out);
+        out += 4;
+    }
+    for(int i=0; i < listPool.size(); i++)   {
+        qToLittleEndian<quint16>(listPool[i],out);
+        out += 2;
+    }
+
+    return true;
+}
+
+bool checkRefinedTile(QByteArray const &data, int factor)
+{
+    if(data.size() < kTileRefineHeaderSize)   {
+        return false;
+    }
+    uchar const * in = reinterpret_cast<uchar const *>(data.constData());
+    if(qFromLittleEndian<quint16>(in) != factor)   {
+        return false;
+    }
+
+    qint64 const numBlocks = qFromLittleEndian<quint32>(in+4);
+    qint64 const tableSize = numBlocks*factor*factor;
+    qint64 const poolBytes = data.size() - kTileRefineHeaderSize -
+                             numBlocks*4 - tableSize*4;
+    int const blockBytes = kTileBlockSize*kTileBlockSize*2;
+    if(poolBytes < 0 || poolBytes % blockBytes != 0)   {
+        return false;
+    }
+    qint64 const poolBlocks = poolBytes/blockBytes;
+
+    // block indices have to be sorted for the binary
+    // search and pool entries have to be in range
+    uchar const * listBlocks = in + kTileRefineHeaderSize;
+    for(qint64 i=1; i < numBlocks; i++)   {
+        if(qFromLittleEndian<quint32>(listBlocks+4*(i-1)) >=
+           qFromLittleEndian<quint32>(listBlocks+4*i))   {
+            return false;
+        }
+    }
+
+    uchar const * table = listBlocks + 4*numBlocks;
+    for(qint64 i=0; i < tableSize; i++)   {
+        quint32 entry = qFromLittleEndian<quint32>(table+4*i);
+        if(!(entry & kTileBlockUniform) && entry >= poolBlocks)   {
+            return false;
+        }
+    }
+
+    return true;
+}
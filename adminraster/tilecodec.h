@@ -0,0 +1,333 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef TILECODEC_H
+#define TILECODEC_H
+
+// qt
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+#include <QImage>
+#include <QtEndian>
+
+// Tiles are square grids of admin1 ids. They're stored
+// in the tiles table of adminraster.sqlite in one of the
+// following formats; the format used for a database is
+// saved in the meta table under 'tile_format'
+enum TileFormat
+{
+    // RGB888 png with the admin1 id as the pixel
+    // color and white for no region
+    TILE_FORMAT_PNG,
+
+    // row major array of little endian 16-bit ids
+    TILE_FORMAT_RAW16,
+
+    // row major runs of ids, each stored as a little
+    // endian 16-bit run length followed by the id
+    TILE_FORMAT_RLE16,
+
+    // zlib compressed block tile (see below)
+    TILE_FORMAT_BLOCK16
+};
+
+// id used for pixels that don't have a region
+quint16 const kTileNoRegion = 0xFFFF;
+
+// Block tiles are a two level grid that can be sampled
+// in place. A tile where every pixel has the same id is
+// stored as just that id. Otherwise the tile is split into
+// kTileBlockSize x kTileBlockSize blocks, and a block where
+// every pixel has the same id is stored as a single table
+// entry. All values are little endian:
+//
+//   quint16    block size, or 0 for a uniform tile
+//   quint16    id of a uniform tile, otherwise the layout
+//              of the table and the pool
+//   quint32[]  block table; an entry with kTileBlockUniform
+//              set holds the id of a uniform block in its
+//              low 16 bits, otherwise it's the index of the
+//              block in the pool
+//   quint16[]  pool of ids for mixed blocks
+//
+// With kTileBlockRowMajor the table and the ids in each
+// pool block are row major. With kTileBlockZOrder both are
+// in Z-order (see mortonCode) so pixels and blocks that are
+// close together are mostly close together in memory too,
+// and the pool blocks are in the order of the table; table
+// entries past the edge of the tile are uniform kTileNoRegion.
+// Sampling a pixel takes at most two dependent reads
+int const kTileBlockSize = 8;
+int const kTileBlockShift = 3;
+quint32 const kTileBlockUniform = 0x80000000;
+int const kTileBlockHeaderSize = 4;
+quint16 const kTileBlockRowMajor = 0;
+quint16 const kTileBlockZOrder = 1;
+
+// interleaves the bits of two 16-bit values, x in the
+// even bits and y in the odd ones, giving the position of
+// (x,y) along a Z-order (Morton) curve
+inline quint32 mortonCode(quint32 x, quint32 y)
+{
+    x &= 0xFFFF;
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+
+    y &= 0xFFFF;
+    y = (y | (y << 8)) & 0x00FF00FF;
+    y = (y | (y << 4)) & 0x0F0F0F0F;
+    y = (y | (y << 2)) & 0x33333333;
+    y = (y | (y << 1)) & 0x55555555;
+
+    return x | (y << 1);
+}
+
+// number of entries in the block table of a tile
+inline int blockTableSize(int blocksPerSide, quint16 layout)
+{
+    if(layout == kTileBlockZOrder)   {
+        return mortonCode(blocksPerSide-1,blocksPerSide-1)+1;
+    }
+    return blocksPerSide*blocksPerSide;
+}
+
+// index of block (bx,by) in the block table
+inline quint32 blockTableIndex(int bx, int by,
+                               int blocksPerSide,
+                               quint16 layout)
+{
+    if(layout == kTileBlockZOrder)   {
+        return mortonCode(bx,by);
+    }
+    return by*blocksPerSide + bx;
+}
+
+// index of pixel (x,y) of a block in its pool block,
+// where x and y are in [0,kTileBlockSize)
+inline int blockPixelIndex(int x, int y, quint16 layout)
+{
+    if(layout == kTileBlockZOrder)   {
+        // spreads the 3 bits of a coordinate out
+        static uchar const kSpread[kTileBlockSize] =
+            { 0x00,0x01,0x04,0x05,0x10,0x11,0x14,0x15 };
+        return kSpread[x] | (kSpread[y] << 1);
+    }
+    return (y << kTileBlockShift) | x;
+}
+
+QString tileFormatName(TileFormat format);
+bool tileFormatFromName(QString const &name, TileFormat &format);
+
+// converts a tile image painted with admin1 ids
+// as colors into an array of ids
+void tileImageToIds(QImage const &image,
+                    QVector<quint16> &ids);
+
+// default compression effort for encodeTileIds
+int const kTileEffortDefault = -1;
+
+// encodes a tileSize x tileSize array of ids; effort is
+// the zlib level (0-9) used for png and block16 tiles or
+// kTileEffortDefault for the format's default. Png tiles
+// encoded with an explicit effort are written with a
+// palette if they have 256 or fewer ids
+bool encodeTileIds(QVector<quint16> const &ids,
+                   int tileSize,
+                   TileFormat format,
+                   QByteArray &data,
+                   int effort=kTileEffortDefault);
+
+// decodes data saved in the given format into a
+// tileSize x tileSize array of ids
+bool decodeTileIds(QByteArray const &data,
+                   int tileSize,
+                   TileFormat format,
+                   QVector<quint16> &ids);
+
+// builds an uncompressed block tile out of a
+// tileSize x tileSize array of ids; tileSize must be
+// a multiple of kTileBlockSize
+bool encodeBlockTile(QVector<quint16> const &ids,
+                     int tileSize,
+                     QByteArray &data,
+                     quint16 layout=kTileBlockZOrder);
+
+// checks that size bytes of data hold a valid block tile
+// that can be sampled in place with sampleBlockTile
+bool checkBlockTile(uchar const * data, qint64 size, int tileSize);
+
+// expands an uncompressed block tile back into
+// a tileSize x tileSize array of ids
+bool decodeBlockTile(QByteArray const &data,
+                     int tileSize,
+                     QVector<quint16> &ids);
+
+// returns the id of pixel (x,y) in an uncompressed
+// block tile; the data isn't checked
+inline quint16 sampleBlockTile(uchar const * data,
+                               int tileSize,
+                               int x, int y)
+{
+    quint16 const layout = qFromLittleEndian<quint16>(data+2);
+    if(data[0] == 0 && data[1] == 0)   {
+        return layout;
+    }
+
+    int const blocksPerSide = tileSize >> kTileBlockShift;
+    uchar const * table = data + kTileBlockHeaderSize;
+    quint32 entry = qFromLittleEndian<quint32>(
+                table + 4*blockTableIndex(x >> kTileBlockShift,
+                                          y >> kTileBlockShift,
+                                          blocksPerSide,layout));
+
+    if(entry & kTileBlockUniform)   {
+        return quint16(entry);
+    }
+
+    uchar const * pool = table + 4*blockTableSize(blocksPerSide,layout);
+    int const blockPixels = kTileBlockSize*kTileBlockSize;
+    int const pixel = blockPixelIndex(x & (kTileBlockSize-1),
+                                      y & (kTileBlockSize-1),
+                                      layout);
+
+    return qFromLittleEndian<quint16>(
+                pool + 2*(qint64(entry)*blockPixels + pixel));
+}
+
+// returns true if pixel (x,y) of an uncompressed block tile
+// is in a uniform block and isn't on the edge of that block
+// or of the tile, so all of its neighbours have the same id
+// as it does
+inline bool isBlockInterior(uchar const * data,
+                            int tileSize,
+                            int x, int y)
+{
+    if(data[0] == 0 && data[1] == 0)   {
+        return (x > 0 && y > 0 && x < tileSize-1 && y < tileSize-1);
+    }
+
+    int const edge = kTileBlockSize-1;
+    int const bx = x & edge;
+    int const by = y & edge;
+    if(bx == 0 || by == 0 || bx == edge || by == edge)   {
+        return false;
+    }
+
+    int const blocksPerSide = tileSize >> kTileBlockShift;
+    quint32 entry = qFromLittleEndian<quint32>(
+                data + kTileBlockHeaderSize +
+                4*blockTableIndex(x >> kTileBlockShift,
+                                  y >> kTileBlockShift,
+                                  blocksPerSide,
+                                  qFromLittleEndian<quint16>(data+2)));
+
+    return (entry & kTileBlockUniform) != 0;
+}
+
+// Refined tiles add detail to the mixed blocks of a block
+// tile. Every mixed block that straddles a boundary is
+// rendered again at factor times the tile's resolution and
+// stored as a (factor x factor) grid of kTileBlockSize
+// blocks, using the same uniform/pool scheme as a block
+// tile. All values are little endian:
+//
+//   quint16    factor
+//   quint16    reserved (0)
+//   quint32    number of refined blocks
+//   quint32[]  sorted indices (by*blocksPerSide + bx) of
+//              the refined blocks in the block tile
+//   quint32[]  factor*factor entries for each refined
+//              block, row major; same as a block table
+//   quint16[]  pool of row major ids for mixed fine blocks
+int const kTileRefineHeaderSize = 8;
+int const kTileRefineMaxFactor = 8;
+
+// builds an uncompressed refined tile; listBlockIds holds
+// the sorted indices of the refined blocks and listFineIds
+// holds the (kTileBlockSize*factor)^2 row major fine ids of
+// each of those blocks one after the other
+bool encodeRefinedTile(QVector<quint32> const &listBlockIds,
+                       QVector<quint16> const &listFineIds,
+                       int factor,
+                       QByteArray &data);
+
+// checks that data holds a valid refined tile that can
+// be sampled in place with sampleRefinedTile
+bool checkRefinedTile(QByteArray const &data, int factor);
+
+// returns the id of the fine pixel (fx,fy) in an uncompressed
+// refined tile, where fine pixel coordinates are factor times
+// the tile's pixel coordinates; returns false if the block
+// the pixel is in wasn't refined
+inline bool sampleRefinedTile(uchar const * data,
+                              int tileSize,
+                              int fx, int fy,
+                              quint16 &id)
+{
+    int const factor = qFromLittleEndian<quint16>(data);
+    int const fineBlockSize = kTileBlockSize*factor;
+    int const blocksPerSide = tileSize >> kTileBlockShift;
+    quint32 const numBlocks = qFromLittleEndian<quint32>(data+4);
+
+    int const bx = fx/fineBlockSize;
+    int const by = fy/fineBlockSize;
+    quint32 const blockIdx = by*blocksPerSide + bx;
+
+    // binary search for the block
+    uchar const * listBlocks = data + kTileRefineHeaderSize;
+    quint32 lo = 0;
+    quint32 hi = numBlocks;
+    while(lo < hi)   {
+        quint32 mid = (lo+hi)/2;
+        if(qFromLittleEndian<quint32>(listBlocks+4*mid) < blockIdx)   {
+            lo = mid+1;
+        }
+        else   {
+            hi = mid;
+        }
+    }
+    if(lo == numBlocks || qFromLittleEndian<quint32>(listBlocks+4*lo) != blockIdx)   {
+        return false;
+    }
+
+    // position within the refined block
+    int const lx = fx - bx*fineBlockSize;
+    int const ly = fy - by*fineBlockSize;
+
+    uchar const * table = listBlocks + 4*numBlocks;
+    quint32 entry = qFromLittleEndian<quint32>(
+                table + 4*(lo*factor*factor +
+                           (ly >> kTileBlockShift)*factor +
+                           (lx >> kTileBlockShift)));
+
+    if(entry & kTileBlockUniform)   {
+        id = quint16(entry);
+        return true;
+    }
+
+    uchar const * pool = table + 4*numBlocks*factor*factor;
+    int const blockPixels = kTileBlockSize*kTileBlockSize;
+    int const pixel = ((ly & (kTileBlockSize-1)) << kTileBlockShift) |
+                      (lx & (kTileBlockSize-1));
+
+    id = qFromLittleEndian<quint16>(pool + 2*(qint64(entry)*blockPixels + pixel));
+    return true;
+}
+
+#endif // TILECODEC_H
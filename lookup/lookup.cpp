@@ -16,22 +16,26 @@
 
 
 #include <exception>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <algorithm>
 
 // qt
 #include <QCoreApplication>
 #include <QStringList>
 #include <QDebug>
-#include <QImage>
-#include <QDir>
 #include <QFile>
-#include <QColor>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QtEndian>
 
-// kompex
-#include "KompexSQLitePrerequisites.h"
-#include "KompexSQLiteDatabase.h"
-#include "KompexSQLiteStatement.h"
-#include "KompexSQLiteException.h"
-#include "KompexSQLiteBlob.h"
+// adminraster
+#include "adminrasterindex.h"
+
+#include "lookupio.h"
+#include "lookupserver.h"
 
 void badInput()
 {
@@ -41,177 +45,608 @@ void badInput()
     qDebug() << "  by the longitude and latitude.";
     qDebug() << "Ex:";
     qDebug() << "./lookup /path/to/adminraster.sqlite -79.3 43.5";
+    qDebug() << "* Pass -batch instead of the coordinates to read";
+    qDebug() << "  'lon lat' lines from stdin (or from a file given";
+    qDebug() << "  after -batch) and write one tab separated result";
+    qDebug() << "  line per input line to stdout.";
+    qDebug() << "Ex:";
+    qDebug() << "./lookup /path/to/adminraster.sqlite -batch points.txt";
+    qDebug() << "* Pass -binary to look up packed little endian lon,lat";
+    qDebug() << "  pairs of float64s (or float32s with -binary f32) read";
+    qDebug() << "  from a file, which is memory mapped, or from stdin (-).";
+    qDebug() << "  A packed int32 id (-1 for no region) is written for";
+    qDebug() << "  each point to the ids file (or stdout with -) and the";
+    qDebug() << "  result line of every id that was found is written";
+    qDebug() << "  once to the names file.";
+    qDebug() << "Ex:";
+    qDebug() << "./lookup /path/to/adminraster.sqlite -binary f32 points.bin ids.bin names.tsv";
+    qDebug() << "* Pass -bench to time batch lookups of random points";
+    qDebug() << "  with 1 to N threads. The number of points and the";
+    qDebug() << "  max number of threads can optionally be given.";
+    qDebug() << "Ex:";
+    qDebug() << "./lookup /path/to/adminraster.sqlite -bench 10000000 64";
+    qDebug() << "* Pass -serve and the path to a socket to keep the raster";
+    qDebug() << "  loaded and answer 'lon lat' lines sent over a local";
+    qDebug() << "  socket with the same result lines as -batch.";
+    qDebug() << "Ex:";
+    qDebug() << "./lookup /path/to/adminraster.sqlite -serve /tmp/adminraster.sock";
+    qDebug() << "* Any of the above can be preceded by -flat and the path";
+    qDebug() << "  to an adminraster.flat file to memory map tiles from";
+    qDebug() << "Ex:";
+    qDebug() << "./lookup /path/to/adminraster.sqlite -flat /path/to/adminraster.flat -79.3 43.5";
 }
 
-void getTilePixel(double lon,
-                  double lat,
-                  size_t &tile_idx,
-                  size_t &pixel_x,
-                  size_t &pixel_y)
-{
-    size_t adjTile = 0;
-    double adjLon = lon + 180.0;
-    double adjLat = (lat-90.0)*-1.0;
-    if(lon > 0.0)   {
-        adjTile = 324;
-        adjLon = lon;
-    }
-    size_t rowIdx = adjLat/10;
-    size_t colIdx = adjLon/10;
-
-    tile_idx = (rowIdx*18 + colIdx) + adjTile;
-    pixel_x = adjLon*100 - colIdx*1000;
-    pixel_y = adjLat*100 - rowIdx*1000;
-}
+// number of points read in and looked up at once in batch mode
+int const kBatchSize = 1 << 20;
 
-int main(int argc, char *argv[])
+int runBatch(AdminRasterIndex &index, QString const &pathInput)
 {
-    QCoreApplication app(argc,argv);
+    QFile inputFile;
+    if(pathInput.isEmpty())   {
+        if(!inputFile.open(stdin,QIODevice::ReadOnly))   {
+            qDebug() << "ERROR: Could not read from stdin";
+            return -1;
+        }
+    }
+    else   {
+        inputFile.setFileName(pathInput);
+        if(!inputFile.open(QIODevice::ReadOnly))   {
+            qDebug() << "ERROR: Could not open input file" << pathInput;
+            return -1;
+        }
+    }
 
-    // check input args
-    QStringList inputArgs = app.arguments();
-    if(inputArgs.size() < 4)   {
-        badInput();
+    QFile outputFile;
+    if(!outputFile.open(stdout,QIODevice::WriteOnly))   {
+        qDebug() << "ERROR: Could not write to stdout";
         return -1;
     }
 
-    bool opOk = false;
+    QVector<QByteArray> listRegionLines;
+    buildRegionLines(index,listRegionLines);
+
+    QVector<double> listLonLat;
+    QVector<int> listIds;
+    listLonLat.reserve(kBatchSize*2);
+    listIds.reserve(kBatchSize);
+
+    int const numThreads = QThread::idealThreadCount();
+
+    QByteArray output;
+    char line[1024];
+    bool inputDone = false;
+    while(!inputDone)   {
+        // read in a batch of points; lines that can't be
+        // parsed get a NaN point so the output stays in
+        // step with the input
+        listLonLat.clear();
+        while(listLonLat.size() < kBatchSize*2)   {
+            qint64 lineLength = inputFile.readLine(line,sizeof(line));
+            if(lineLength < 0)   {
+                inputDone = true;
+                break;
+            }
 
-    double lon = inputArgs[2].toDouble(&opOk);
-    if(!opOk || (lon < -180.0) || (lon > 180.0))   {
-        qDebug() << "ERROR: Invalid longitude";
-        return -1;
-    }
+            // a line that doesn't fit in the buffer is skipped
+            // up to its end and gets a single no region result
+            bool tooLong = false;
+            while(lineLength == qint64(sizeof(line))-1 && line[lineLength-1] != '\n')   {
+                tooLong = true;
+                lineLength = inputFile.readLine(line,sizeof(line));
+                if(lineLength <= 0)   {
+                    break;
+                }
+            }
 
-    double lat = inputArgs[3].toDouble(&opOk);
-    if(!opOk || (lat < -90.0) || (lat > 90.0))   {
-        qDebug() << "ERROR: Invalid longitude";
-        return -1;
-    }
+            double lon,lat;
+            if(tooLong || !parsePoint(line,lon,lat))   {
+                lon = lat = std::numeric_limits<double>::quiet_NaN();
+            }
+            listLonLat.push_back(lon);
+            listLonLat.push_back(lat);
+        }
+
+        int numPoints = listLonLat.size()/2;
+        if(numPoints == 0)   {
+            break;
+        }
 
-    Kompex::SQLiteDatabase  * pDatabase;
-    Kompex::SQLiteStatement * pStmt;
-    try   {
-        pDatabase = new Kompex::SQLiteDatabase(
-                    inputArgs[1].toStdString(),
-                    SQLITE_OPEN_READONLY,0);
+        listIds.resize(numPoints);
+        index.lookupIds(listLonLat.constData(),numPoints,
+                        listIds.data(),numThreads);
 
-        pStmt = new Kompex::SQLiteStatement(pDatabase);
-    }
-    catch(Kompex::SQLiteException &exception)   {
-        qDebug() << "ERROR: Could not open database:";
-        qDebug() << QString::fromStdString(exception.GetString());
-        return -1;
+        output.clear();
+        for(int i=0; i < numPoints; i++)   {
+            int id = listIds[i];
+            output.append((id < 0) ? kNoRegionLine : listRegionLines[id]);
+        }
+        outputFile.write(output);
     }
+    outputFile.flush();
 
-    // get tile and pixel based on input coordinates
-    size_t tileIdx,pixel_x,pixel_y;
-    getTilePixel(lon,lat,tileIdx,pixel_x,pixel_y);
+    return 0;
+}
 
-    qDebug() << "Input Coords: (" << lon << "," << lat << ")";
-    qDebug() << "Tile:" << tileIdx;
-    qDebug() << "Pixel: (" << pixel_x << "," << pixel_y << ")";
+// reads until maxBytes have been read or the input ends
+qint64 readFully(QIODevice &device, char * data, qint64 maxBytes)
+{
+    qint64 numRead = 0;
+    while(numRead < maxBytes)   {
+        qint64 n = device.read(data+numRead,maxBytes-numRead);
+        if(n <= 0)   {
+            break;
+        }
+        numRead += n;
+    }
+    return numRead;
+}
 
-    // get tile image data from the database
-    Kompex::SQLiteBlob * pBlob;
-    pBlob = new Kompex::SQLiteBlob(pDatabase,"main","tiles","png",
-                                   tileIdx,Kompex::BLOB_READONLY);
+int runBinaryBatch(AdminRasterIndex &index,
+                   PointFormat format,
+                   QString const &pathInput,
+                   QString const &pathIds,
+                   QString const &pathNames)
+{
+    int const pointBytes = pointSize(format);
+
+    // regular files are memory mapped so float64 input can
+    // be looked up in place; stdin is read in batches
+    QFile inputFile;
+    uchar * mapped = NULL;
+    qint64 mappedSize = 0;
+    if(pathInput == "-")   {
+        if(!inputFile.open(stdin,QIODevice::ReadOnly))   {
+            qDebug() << "ERROR: Could not read from stdin";
+            return -1;
+        }
+    }
+    else   {
+        inputFile.setFileName(pathInput);
+        if(!inputFile.open(QIODevice::ReadOnly))   {
+            qDebug() << "ERROR: Could not open input file" << pathInput;
+            return -1;
+        }
+        mappedSize = inputFile.size();
+        if(mappedSize > 0)   {
+            mapped = inputFile.map(0,mappedSize);
+        }
+        if(mapped && mappedSize % pointBytes != 0)   {
+            qDebug() << "WARN: Ignoring a partial point at the end of the input";
+        }
+    }
 
-    int blobSize = pBlob->GetBlobSize();
-    char * readBuffer = new char[blobSize];
-    pBlob->ReadBlob(readBuffer,blobSize);
+    QFile idsFile;
+    bool idsOpen = false;
+    if(pathIds == "-")   {
+        idsOpen = idsFile.open(stdout,QIODevice::WriteOnly);
+    }
+    else   {
+        idsFile.setFileName(pathIds);
+        idsOpen = idsFile.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    }
+    if(!idsOpen)   {
+        qDebug() << "ERROR: Could not open ids output" << pathIds;
+        return -1;
+    }
 
-    QImage tileImage = QImage::fromData((uchar*)readBuffer,blobSize);
-    delete readBuffer;
-    delete pBlob;
+    QVector<double> listLonLat(kBatchSize*2);
+    QVector<int> listIds(kBatchSize);
+    QVector<bool> listFound(index.regionCount(),false);
+    QByteArray inputChunk;
+    QByteArray output;
+
+    int const numThreads = QThread::idealThreadCount();
+    qint64 offset = 0;
+    qint64 numTotal = 0;
+    while(true)   {
+        int numPoints = 0;
+        double const * lonlat = listLonLat.constData();
+
+        if(mapped)   {
+            numPoints = int(std::min<qint64>(kBatchSize,(mappedSize-offset)/pointBytes));
+            uchar const * data = mapped+offset;
+            offset += qint64(numPoints)*pointBytes;
+#if (Q_BYTE_ORDER == Q_LITTLE_ENDIAN)
+            if(format == POINT_FORMAT_F64)   {
+                // mapped files are page aligned
+                lonlat = reinterpret_cast<double const *>(data);
+            }
+            else
+#endif
+            {
+                unpackPoints(data,numPoints,format,listLonLat.data());
+            }
+        }
+        else   {
+            inputChunk.resize(kBatchSize*pointBytes);
+            qint64 numBytes = readFully(inputFile,inputChunk.data(),inputChunk.size());
+            if(numBytes % pointBytes != 0)   {
+                qDebug() << "WARN: Ignoring a partial point at the end of the input";
+            }
+            numPoints = int(numBytes/pointBytes);
+            unpackPoints(reinterpret_cast<uchar const *>(inputChunk.constData()),
+                         numPoints,format,listLonLat.data());
+        }
 
-    // sample pixel
-    QColor pixelColor(tileImage.pixel(pixel_x,pixel_y));
-    QString colorName = pixelColor.name();      // #RRGGBB
-    colorName.remove(0,1);                      // remove '#'
-    QString dbIdx = QString::number(colorName.toInt(&opOk,16),10);
+        if(numPoints == 0)   {
+            break;
+        }
 
-    qDebug() << "Pixel Color: " << colorName;
-    qDebug() << "Pixel Value: " << dbIdx;
+        index.lookupIds(lonlat,numPoints,listIds.data(),numThreads);
+        for(int i=0; i < numPoints; i++)   {
+            if(listIds[i] >= 0)   {
+                listFound[listIds[i]] = true;
+            }
+        }
 
+        output.clear();
+        packIds(listIds.constData(),numPoints,output);
+        if(idsFile.write(output) != output.size())   {
+            qDebug() << "ERROR: Could not write ids";
+            return -1;
+        }
+        numTotal += numPoints;
+    }
+    idsFile.flush();
 
-    // lookup database entry
-    QString sqlQuery = "SELECT * FROM admin1 WHERE id="+dbIdx+";";
-    pStmt->Sql(sqlQuery.toStdString());
+    if(mapped)   {
+        inputFile.unmap(mapped);
+    }
 
-    QString admin1_name = "N/A";
-    bool admin1_disp = false;
+    // names of every region that was found, once each
+    QFile namesFile(pathNames);
+    if(!namesFile.open(QIODevice::WriteOnly | QIODevice::Truncate))   {
+        qDebug() << "ERROR: Could not open names output" << pathNames;
+        return -1;
+    }
 
-    QString admin0_name = "N/A";
-    QString sov_name = "N/A";
+    QVector<QByteArray> listRegionLines;
+    buildRegionLines(index,listRegionLines);
 
-    if(pStmt->FetchRow())   {
-        // get admin1 data
-        admin1_name = QString::fromStdString(pStmt->GetColumnString("name"));
-        admin1_disp = pStmt->GetColumnBool("disputed");
-        int admin0_idx = pStmt->GetColumnInt("admin0");
-        int sov_idx = pStmt->GetColumnInt("sov");
-        pStmt->FreeQuery();
+    output.clear();
+    for(int i=0; i < listFound.size(); i++)   {
+        if(listFound[i])   {
+            output.append(listRegionLines[i]);
+        }
+    }
+    namesFile.write(output);
 
-        // get admin0 data
-        if(admin0_idx >= 0)   {
-            sqlQuery = QString("SELECT * FROM admin0 WHERE id="+
-                               QString::number(admin0_idx,10)+";");
-            pStmt->Sql(sqlQuery.toStdString());
+    qDebug() << "INFO: Looked up" << numTotal << "points";
+    return 0;
+}
 
-            if(pStmt->FetchRow())   {
-                admin0_name = QString::fromStdString(pStmt->GetColumnString("name"));
-            }
-            pStmt->FreeQuery();
+// checks that the vector and scalar tile/pixel transforms
+// agree with each other and with getTilePixel for the given
+// points plus every pairing of the coordinates on and right
+// next to the edges of the raster and the hemispheres
+bool checkTilePixels(RasterGrid const &grid, QVector<double> listLonLat)
+{
+    double const listEdgeLons[] = { -180.0, 180.0, 0.0, -0.0, 90.0, -90.0 };
+    double const listEdgeLats[] = { -90.0, 90.0, 0.0, -0.0, 45.0, -45.0 };
+    int const numEdges = 6;
+
+    QVector<double> listLons, listLats;
+    for(int i=0; i < numEdges; i++)   {
+        double lon = listEdgeLons[i];
+        double lat = listEdgeLats[i];
+        listLons << lon << nextafter(lon,-1000.0) << nextafter(lon,1000.0);
+        listLats << lat << nextafter(lat,-1000.0) << nextafter(lat,1000.0);
+    }
+    for(int i=0; i < listLons.size(); i++)   {
+        for(int j=0; j < listLats.size(); j++)   {
+            listLonLat.push_back(listLons[i]);
+            listLonLat.push_back(listLats[j]);
         }
+    }
 
-        // get sov data
-        if(sov_idx >= 0)   {
-            sqlQuery = QString("SELECT * FROM sov WHERE id="+
-                               QString::number(sov_idx,10)+";");
-            pStmt->Sql(sqlQuery.toStdString());
+    int const numPoints = listLonLat.size()/2;
+    QVector<int> listTilesSimd(numPoints), listTilesScalar(numPoints);
+    QVector<quint32> listPixelsSimd(numPoints), listPixelsScalar(numPoints);
+    grid.getTilePixels(listLonLat.constData(),numPoints,
+                       listTilesSimd.data(),listPixelsSimd.data(),true);
+    grid.getTilePixels(listLonLat.constData(),numPoints,
+                       listTilesScalar.data(),listPixelsScalar.data(),false);
+
+    int numMismatches = 0;
+    for(int i=0; i < numPoints; i++)   {
+        double const lon = listLonLat[i*2];
+        double const lat = listLonLat[i*2+1];
+        bool ok = (listTilesSimd[i] == listTilesScalar[i]) &&
+                  (listTilesSimd[i] < 0 || listPixelsSimd[i] == listPixelsScalar[i]);
+
+        // points in range also have to match getTilePixel
+        bool inRange = (lon >= -180.0 && lon <= 180.0 &&
+                        lat >= -90.0 && lat <= 90.0);
+        if(ok && inRange)   {
+            size_t tile_idx,pixel_x,pixel_y;
+            grid.getTilePixel(lon,lat,tile_idx,pixel_x,pixel_y);
+            ok = (listTilesScalar[i] == int(tile_idx)) &&
+                 (listPixelsScalar[i] == ((quint32(pixel_y) << 16) | quint32(pixel_x)));
+        }
+        else if(ok)   {
+            ok = (listTilesScalar[i] == -1);
+        }
 
-            if(pStmt->FetchRow())   {
-                sov_name = QString::fromStdString(pStmt->GetColumnString("name"));
+        if(!ok)   {
+            if(numMismatches < 10)   {
+                qDebug() << "ERROR: Tile/pixel transform mismatch at"
+                         << QString::number(lon,'g',17) << QString::number(lat,'g',17)
+                         << RasterGrid::simdName() << listTilesSimd[i] << listPixelsSimd[i]
+                         << "scalar" << listTilesScalar[i] << listPixelsScalar[i];
             }
-            pStmt->FreeQuery();
+            numMismatches++;
         }
-
-        qDebug() << "Admin1: " << admin1_name;
-        qDebug() << "Admin0: " << admin0_name;
-        qDebug() << "Sov: " << sov_name;
-        qDebug() << "Disputed: " << admin1_disp;
-    }
-    else   {
-        pStmt->FreeQuery();
-        qDebug() << "INFO: Nothing found at input coordinates";
     }
 
-    return 0;
+    if(numMismatches > 0)   {
+        qDebug() << "ERROR:" << numMismatches << "of" << numPoints
+                 << "points transformed differently";
+        return false;
+    }
+    qDebug() << "INFO: Tile/pixel transform:" << RasterGrid::simdName()
+             << "matches scalar for" << numPoints << "points";
+    return true;
 }
 
+int runBench(AdminRasterIndex &index, int numPoints, int maxThreads)
+{
+    qDebug() << "INFO: Generating" << numPoints << "random points...";
+    QVector<double> listLonLat(numPoints*2);
+    qsrand(1234);
+    for(int i=0; i < numPoints; i++)   {
+        listLonLat[i*2]   = (double(qrand())/RAND_MAX)*360.0 - 180.0;
+        listLonLat[i*2+1] = (double(qrand())/RAND_MAX)*180.0 - 90.0;
+    }
+    QVector<int> listIds(numPoints);
+
+    // keep every tile in memory and decode them all
+    // up front so only the lookups themselves are timed
+    qDebug() << "INFO: Decoding tiles...";
+    index.setMaxCachedTiles(index.tileCount());
+    index.lookupIds(listLonLat.constData(),numPoints,listIds.data(),maxThreads);
+
+    // memory/latency trade-off for this grid; flat
+    // rasters aren't cached so they report 0 here
+    RasterGrid const &grid = index.grid();
+    qDebug() << "INFO: Resolution:" << grid.resolution << "px/degree"
+             << "Tile size:" << grid.tileSize << "px"
+             << "Tiles:" << grid.tileCount()
+             << "Refine factor:" << index.refineFactor();
+    qDebug() << "INFO: Decoded tile memory:"
+             << index.cachedTileBytes()/1024 << "KiB";
+    if(index.hasGeometry())   {
+        qDebug() << "INFO: Decoded boundary geometry memory:"
+                 << index.cachedGeometryBytes()/1024 << "KiB";
+    }
 
+    // the vector kernel has to give the same results
+    // as the scalar one before it's worth timing
+    if(!checkTilePixels(grid,listLonLat))   {
+        return -1;
+    }
 
+    // cost of turning coordinates into tiles and pixels
+    // on its own, with and without the vector kernel
+    QVector<int> listTiles(numPoints);
+    QVector<quint32> listPixels(numPoints);
+    QElapsedTimer timer;
+    for(int simd=0; simd < 2; simd++)   {
+        timer.start();
+        grid.getTilePixels(listLonLat.constData(),numPoints,
+                           listTiles.data(),listPixels.data(),simd == 1);
+        double secs = timer.nsecsElapsed()*1E-9;
+
+        qDebug() << "INFO: Tile/pixel transform:"
+                 << ((simd == 1) ? RasterGrid::simdName() : "scalar")
+                 << "ns/point:" << (secs*1E9)/numPoints;
+    }
 
+    QList<int> listThreadCounts;
+    for(int n=1; n < maxThreads; n*=2)   {
+        listThreadCounts.push_back(n);
+    }
+    listThreadCounts.push_back(maxThreads);
+
+    for(int i=0; i < listThreadCounts.size(); i++)   {
+        int numThreads = listThreadCounts[i];
+        timer.start();
+        index.lookupIds(listLonLat.constData(),numPoints,
+                        listIds.data(),numThreads);
+        double secs = timer.nsecsElapsed()*1E-9;
+
+        qDebug() << "INFO: Threads:" << numThreads
+                 << "Points/sec:" << qint64(numPoints/secs)
+                 << "ns/point:" << (secs*1E9*numThreads)/numPoints;
+    }
 
+    // latency of one point per call, which is what
+    // a -serve client sending single lines sees
+    int const numCalls = std::min(numPoints,100000);
+    QVector<qint64> listLatency(numCalls);
+    for(int i=0; i < numCalls; i++)   {
+        timer.start();
+        index.lookupIds(listLonLat.constData()+i*2,1,listIds.data()+i);
+        listLatency[i] = timer.nsecsElapsed();
+    }
+    std::sort(listLatency.begin(),listLatency.end());
+    qDebug() << "INFO: Single point latency"
+             << "p50 ns:" << listLatency[numCalls/2]
+             << "p99 ns:" << listLatency[qint64(numCalls)*99/100];
+
+    // a single thread with a small tile cache, with and
+    // without sorting the points along a Z-order curve
+    int const smallCacheTiles = 32;
+    index.setMaxCachedTiles(smallCacheTiles);
+    for(int ordered=0; ordered < 2; ordered++)   {
+        index.setLocalityOrder(ordered == 1);
+        timer.start();
+        index.lookupIds(listLonLat.constData(),numPoints,listIds.data(),1);
+        double secs = timer.nsecsElapsed()*1E-9;
+
+        qDebug() << "INFO: Cache:" << smallCacheTiles << "tiles"
+                 << "Locality order:" << ((ordered == 1) ? "on" : "off")
+                 << "ns/point:" << (secs*1E9)/numPoints;
+    }
+    index.setLocalityOrder(false);
+
+    // raster sampling alone for clustered and random
+    // points against row major and Z-order tile layouts;
+    // clustered points are short runs within a few pixels
+    // of each other, like a gps trace. Boundary geometry
+    // is left out so only the tile reads are timed. A flat
+    // raster keeps its own layout for both runs
+    QVector<double> listClustered(numPoints*2);
+    double const jitter = 4.0/grid.resolution;
+    int const runLength = 64;
+    for(int i=0; i < numPoints; i++)   {
+        if(i % runLength == 0)   {
+            listClustered[i*2]   = listLonLat[i*2];
+            listClustered[i*2+1] = listLonLat[i*2+1];
+        }
+        else   {
+            int start = i - (i % runLength);
+            double lon = listClustered[start*2] + (double(qrand())/RAND_MAX - 0.5)*jitter;
+            double lat = listClustered[start*2+1] + (double(qrand())/RAND_MAX - 0.5)*jitter;
+            listClustered[i*2]   = qBound(-180.0,lon,180.0);
+            listClustered[i*2+1] = qBound(-90.0,lat,90.0);
+        }
+    }
 
+    bool const exact = index.exactBoundaries();
+    index.setExactBoundaries(false);
+    index.setMaxCachedTiles(index.tileCount());
+    quint16 const layouts[2] = { kTileBlockRowMajor, kTileBlockZOrder };
+    for(int l=0; l < 2; l++)   {
+        index.setTileLayout(layouts[l]);
+        index.lookupIds(listLonLat.constData(),numPoints,listIds.data(),1);
+
+        for(int clustered=0; clustered < 2; clustered++)   {
+            double const * lonlat = (clustered == 1) ?
+                        listClustered.constData() : listLonLat.constData();
+
+            timer.start();
+            index.lookupIds(lonlat,numPoints,listIds.data(),1);
+            double secs = timer.nsecsElapsed()*1E-9;
+
+            qDebug() << "INFO: Tile layout:"
+                     << ((layouts[l] == kTileBlockZOrder) ? "z-order" : "row major")
+                     << "Points:" << ((clustered == 1) ? "clustered" : "random")
+                     << "ns/point:" << (secs*1E9)/numPoints;
+        }
+    }
+    index.setTileLayout(kTileBlockZOrder);
+    index.setExactBoundaries(exact);
 
+    return 0;
+}
 
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc,argv);
 
+    // check input args
+    QStringList inputArgs = app.arguments();
+    if(inputArgs.size() < 2)   {
+        badInput();
+        return -1;
+    }
 
+    AdminRasterIndex index;
+    if(!index.open(inputArgs[1]))   {
+        return -1;
+    }
 
+    // optional flat raster file
+    if(inputArgs.size() >= 4 && inputArgs[2] == "-flat")   {
+        if(!index.openFlatRaster(inputArgs[3]))   {
+            return -1;
+        }
+        inputArgs.removeAt(2);
+        inputArgs.removeAt(2);
+    }
 
+    if(inputArgs.size() >= 3 && inputArgs[2] == "-batch")   {
+        QString pathInput = (inputArgs.size() > 3) ? inputArgs[3] : QString();
+        return runBatch(index,pathInput);
+    }
 
+    if(inputArgs.size() >= 3 && inputArgs[2] == "-binary")   {
+        PointFormat format = POINT_FORMAT_F64;
+        int argIdx = 3;
+        if(argIdx < inputArgs.size() && inputArgs[argIdx] == "f32")   {
+            format = POINT_FORMAT_F32;
+            argIdx++;
+        }
+        else if(argIdx < inputArgs.size() && inputArgs[argIdx] == "f64")   {
+            argIdx++;
+        }
 
+        if(inputArgs.size() != argIdx+3)   {
+            badInput();
+            return -1;
+        }
+        return runBinaryBatch(index,format,inputArgs[argIdx],
+                              inputArgs[argIdx+1],inputArgs[argIdx+2]);
+    }
 
+    if(inputArgs.size() >= 4 && inputArgs[2] == "-serve")   {
+        LookupServer server(index);
+        if(!server.listen(inputArgs[3]))   {
+            return -1;
+        }
+        return app.exec();
+    }
 
+    if(inputArgs.size() >= 3 && inputArgs[2] == "-bench")   {
+        int numPoints = (inputArgs.size() > 3) ? inputArgs[3].toInt() : 0;
+        int maxThreads = (inputArgs.size() > 4) ? inputArgs[4].toInt() : 0;
+        if(numPoints <= 0)   {
+            numPoints = 10000000;
+        }
+        if(maxThreads <= 0)   {
+            maxThreads = QThread::idealThreadCount();
+        }
+        return runBench(index,numPoints,std::max(maxThreads,1));
+    }
 
+    if(inputArgs.size() < 4)   {
+        badInput();
+        return -1;
+    }
 
+    bool opOk = false;
 
+    double lon = inputArgs[2].toDouble(&opOk);
+    if(!opOk || (lon < -180.0) || (lon > 180.0))   {
+        qDebug() << "ERROR: Invalid longitude";
+        return -1;
+    }
 
+    double lat = inputArgs[3].toDouble(&opOk);
+    if(!opOk || (lat < -90.0) || (lat > 90.0))   {
+        qDebug() << "ERROR: Invalid latitude";
+        return -1;
+    }
 
+    // get tile and pixel based on input coordinates
+    size_t tileIdx,pixel_x,pixel_y;
+    index.getTilePixel(lon,lat,tileIdx,pixel_x,pixel_y);
 
+    qDebug() << "Input Coords: (" << lon << "," << lat << ")";
+    qDebug() << "Tile:" << tileIdx;
+    qDebug() << "Pixel: (" << pixel_x << "," << pixel_y << ")";
 
+    AdminRegion region;
+    if(index.lookup(lon,lat,region))   {
+        qDebug() << "Pixel Value: " << region.id;
+        qDebug() << "Admin1: " << region.admin1;
+        qDebug() << "Admin0: " << region.admin0;
+        qDebug() << "Sov: " << region.sov;
+        qDebug() << "Disputed: " << region.disputed;
+    }
+    else   {
+        qDebug() << "INFO: Nothing found at input coordinates";
+    }
 
-
-
+    return 0;
+}
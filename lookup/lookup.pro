@@ -1,4 +1,4 @@
-QT       += core
+QT       += core network
 
 CONFIG   += console
 TEMPLATE = app
@@ -7,6 +7,13 @@ TEMPLATE = app
 DEFINES += SQLITE_OMIT_LOAD_EXTENSION
 
 
+# adminraster
+PATH_ADMINRASTER = $${PWD}/../adminraster
+INCLUDEPATH += $${PATH_ADMINRASTER}
+LIBS += -L$${OUT_PWD}/../adminraster -ladminraster
+PRE_TARGETDEPS += $${OUT_PWD}/../adminraster/libadminraster.a
+
+
 # kompex
 PATH_KOMPEX = /home/preet/Dev/env/sys/kompex
 INCLUDEPATH += $${PATH_KOMPEX}/include
@@ -22,4 +29,11 @@ HEADERS += \
 LIBS += -L$${PATH_KOMPEX}/lib -lkompex
 
 # main
-SOURCES += lookup.cpp
+HEADERS += \
+    lookupio.h \
+    lookupserver.h
+
+SOURCES += \
+    lookup.cpp \
+    lookupio.cpp \
+    lookupserver.cpp
@@ -0,0 +1,99 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <cstdlib>
+#include <cstring>
+
+// qt
+#include <QString>
+#include <QtEndian>
+
+#include "lookupio.h"
+
+QByteArray const kNoRegionLine("-1\n");
+
+bool parsePoint(char const * line, double &lon, double &lat)
+{
+    // accept 'lon lat' or 'lon,lat'
+    char * end = NULL;
+    lon = strtod(line,&end);
+    if(end == line)   {
+        return false;
+    }
+    while(*end == ' ' || *end == '\t' || *end == ',')   {
+        end++;
+    }
+
+    char const * latStart = end;
+    lat = strtod(latStart,&end);
+    if(end == latStart)   {
+        return false;
+    }
+
+    return (lon >= -180.0 && lon <= 180.0 && lat >= -90.0 && lat <= 90.0);
+}
+
+void buildRegionLines(AdminRasterIndex const &index,
+                      QVector<QByteArray> &listRegionLines)
+{
+    listRegionLines.clear();
+    listRegionLines.resize(index.regionCount());
+    for(int i=0; i < listRegionLines.size(); i++)   {
+        AdminRegion const &region = index.region(i);
+        if(region.id < 0)   {
+            continue;
+        }
+        listRegionLines[i] = QString(QString::number(region.id) + "\t" +
+                                     region.admin1 + "\t" +
+                                     region.admin0 + "\t" +
+                                     region.sov + "\t" +
+                                     (region.disputed ? "1" : "0") +
+                                     "\n").toUtf8();
+    }
+}
+
+void unpackPoints(uchar const * data, int count,
+                  PointFormat format, double * lonlat)
+{
+    if(format == POINT_FORMAT_F64)   {
+#if (Q_BYTE_ORDER == Q_LITTLE_ENDIAN)
+        memcpy(lonlat,data,size_t(count)*16);
+#else
+        for(int i=0; i < count*2; i++)   {
+            quint64 bits = qFromLittleEndian<quint64>(data+i*8);
+            memcpy(lonlat+i,&bits,8);
+        }
+#endif
+        return;
+    }
+
+    for(int i=0; i < count*2; i++)   {
+        quint32 bits = qFromLittleEndian<quint32>(data+i*4);
+        float value;
+        memcpy(&value,&bits,4);
+        lonlat[i] = value;
+    }
+}
+
+void packIds(int const * ids, int count, QByteArray &output)
+{
+    int const offset = output.size();
+    output.resize(offset+count*4);
+    uchar * out = reinterpret_cast<uchar*>(output.data()+offset);
+    for(int i=0; i < count; i++)   {
+        qToLittleEndian<qint32>(ids[i],out+i*4);
+    }
+}
@@ -0,0 +1,62 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef LOOKUPIO_H
+#define LOOKUPIO_H
+
+// qt
+#include <QVector>
+#include <QByteArray>
+
+// adminraster
+#include "adminrasterindex.h"
+
+// parses a 'lon lat' or 'lon,lat' line; returns false if the
+// line can't be parsed or the point is out of range
+bool parsePoint(char const * line, double &lon, double &lat);
+
+// builds the tab separated result line for every region
+// ("id\tadmin1\tadmin0\tsov\tdisputed\n") so writing out a
+// result is just a copy; ids without a region get an empty line
+void buildRegionLines(AdminRasterIndex const &index,
+                      QVector<QByteArray> &listRegionLines);
+
+// Binary bulk lookups read packed little endian lon,lat
+// pairs of 64-bit or 32-bit floats and write a packed little
+// endian int32 id for every point (-1 for no region)
+enum PointFormat
+{
+    POINT_FORMAT_F64,
+    POINT_FORMAT_F32
+};
+
+// bytes taken up by one lon,lat pair
+inline int pointSize(PointFormat format)
+{   return (format == POINT_FORMAT_F64) ? 16 : 8;   }
+
+// converts count packed points into interleaved doubles;
+// like text input, points that are NaN or out of range
+// just end up without a region
+void unpackPoints(uchar const * data, int count,
+                  PointFormat format, double * lonlat);
+
+// appends count ids to output as packed int32s
+void packIds(int const * ids, int count, QByteArray &output);
+
+// result line written for points without a region
+extern QByteArray const kNoRegionLine;
+
+#endif // LOOKUPIO_H
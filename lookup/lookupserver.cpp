@@ -0,0 +1,206 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <limits>
+
+// qt
+#include <QDebug>
+#include <QFile>
+
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#include "lookupio.h"
+#include "lookupserver.h"
+
+namespace
+{
+    // connections that send a line longer
+    // than this are dropped
+    int const kMaxLineLength = 1024;
+
+    // requests are only read from a connection while it
+    // has fewer than this many reply bytes waiting to be
+    // sent, and at most this many request bytes are
+    // buffered per connection, so a client that pipelines
+    // requests without reading the results is held up by
+    // its socket instead of growing the server's memory
+    qint64 const kMaxPendingOutput = 256*1024;
+    qint64 const kReadBufferSize = 64*1024;
+
+    // true if there's nothing at path or if it's a socket,
+    // so it's safe for the server to replace it
+    bool isSocketOrMissing(QString const &path)
+    {
+#ifdef Q_OS_UNIX
+        struct stat info;
+        if(lstat(QFile::encodeName(path).constData(),&info) != 0)   {
+            return true;
+        }
+        return S_ISSOCK(info.st_mode);
+#else
+        Q_UNUSED(path);
+        return true;
+#endif
+    }
+}
+
+LookupServer::LookupServer(AdminRasterIndex &index, QObject * parent) :
+    QObject(parent),
+    m_index(index)
+{
+    buildRegionLines(m_index,m_listRegionLines);
+
+    connect(&m_server,SIGNAL(newConnection()),
+            this,SLOT(onNewConnection()));
+}
+
+bool LookupServer::listen(QString const &pathSocket)
+{
+    // only a stale socket is removed, never a
+    // file that happens to be at the same path
+    if(!isSocketOrMissing(pathSocket))   {
+        qDebug() << "ERROR: Not a socket, won't replace" << pathSocket;
+        return false;
+    }
+
+    QLocalServer::removeServer(pathSocket);
+    if(!m_server.listen(pathSocket))   {
+        qDebug() << "ERROR: Could not listen on" << pathSocket
+                 << m_server.errorString();
+        return false;
+    }
+
+    qDebug() << "INFO: Serving lookups on" << pathSocket;
+    return true;
+}
+
+void LookupServer::onNewConnection()
+{
+    QLocalSocket * socket = m_server.nextPendingConnection();
+    while(socket)   {
+        m_tablePartialInput.insert(socket,QByteArray());
+        socket->setReadBufferSize(kReadBufferSize);
+
+        connect(socket,SIGNAL(readyRead()),
+                this,SLOT(onReadyRead()));
+
+        connect(socket,SIGNAL(bytesWritten(qint64)),
+                this,SLOT(onBytesWritten()));
+
+        connect(socket,SIGNAL(disconnected()),
+                this,SLOT(onDisconnected()));
+
+        socket = m_server.nextPendingConnection();
+    }
+}
+
+void LookupServer::onReadyRead()
+{
+    readRequests(qobject_cast<QLocalSocket*>(sender()));
+}
+
+void LookupServer::onBytesWritten()
+{
+    // requests that were held back while the
+    // client wasn't reading can be read now
+    readRequests(qobject_cast<QLocalSocket*>(sender()));
+}
+
+void LookupServer::readRequests(QLocalSocket * socket)
+{
+    if(socket == NULL || !m_tablePartialInput.contains(socket))   {
+        return;
+    }
+    if(socket->bytesToWrite() > kMaxPendingOutput ||
+       socket->bytesAvailable() == 0)   {
+        return;
+    }
+
+    QByteArray &input = m_tablePartialInput[socket];
+    input.append(socket->readAll());
+    processLines(socket,input);
+}
+
+void LookupServer::onDisconnected()
+{
+    QLocalSocket * socket = qobject_cast<QLocalSocket*>(sender());
+    if(socket == NULL)   {
+        return;
+    }
+
+    m_tablePartialInput.remove(socket);
+    socket->deleteLater();
+}
+
+void LookupServer::dropClient(QLocalSocket * socket)
+{
+    qDebug() << "WARN: Dropping client that sent a line that's too long";
+    m_tablePartialInput.remove(socket);
+    socket->disconnectFromServer();
+}
+
+void LookupServer::processLines(QLocalSocket * socket, QByteArray &input)
+{
+    // the partial line at the end counts too
+    int inputEnd = input.lastIndexOf('\n')+1;
+    if(input.size()-inputEnd > kMaxLineLength)   {
+        dropClient(socket);
+        return;
+    }
+    if(inputEnd == 0)   {
+        return;
+    }
+
+    // terminate every line so parsing stops at the end
+    // of it; lines that can't be parsed get a NaN point
+    // so every request line still gets a result line
+    char * data = input.data();
+    m_listLonLat.clear();
+    int lineStart = 0;
+    for(int i=0; i < inputEnd; i++)   {
+        if(data[i] != '\n')   {
+            continue;
+        }
+        if(i-lineStart > kMaxLineLength)   {
+            dropClient(socket);
+            return;
+        }
+        data[i] = '\0';
+
+        double lon,lat;
+        if(!parsePoint(data+lineStart,lon,lat))   {
+            lon = lat = std::numeric_limits<double>::quiet_NaN();
+        }
+        m_listLonLat.push_back(lon);
+        m_listLonLat.push_back(lat);
+        lineStart = i+1;
+    }
+    input.remove(0,inputEnd);
+
+    int numPoints = m_listLonLat.size()/2;
+    m_listIds.resize(numPoints);
+    m_index.lookupIds(m_listLonLat.constData(),numPoints,m_listIds.data());
+
+    m_output.clear();
+    for(int i=0; i < numPoints; i++)   {
+        int id = m_listIds[i];
+        m_output.append((id < 0) ? kNoRegionLine : m_listRegionLines[id]);
+    }
+    socket->write(m_output);
+}
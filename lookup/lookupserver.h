@@ -0,0 +1,83 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef LOOKUPSERVER_H
+#define LOOKUPSERVER_H
+
+// qt
+#include <QObject>
+#include <QVector>
+#include <QHash>
+#include <QByteArray>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+// adminraster
+#include "adminrasterindex.h"
+
+// Serves lookups over a local (unix domain) socket from
+// the event loop of the thread it lives in. The protocol
+// is line based: clients send 'lon lat' lines and get back
+// one result line per request line, in order, formatted
+// the same as lookup -batch. Any number of requests can be
+// sent without waiting for their results, and all of the
+// complete lines that have arrived on a connection are
+// looked up together. A client that stops reading its
+// results stops having its requests read. Lookups run on
+// the event loop too, so a tile or geometry read that
+// misses the cache delays every connection
+class LookupServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    LookupServer(AdminRasterIndex &index, QObject * parent=0);
+
+    // removes a stale socket at pathSocket and starts
+    // listening on it; fails if something other than a
+    // socket is already there
+    bool listen(QString const &pathSocket);
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onBytesWritten();
+    void onDisconnected();
+
+private:
+    // reads and answers the requests that have arrived on
+    // a connection unless its replies aren't being read
+    void readRequests(QLocalSocket * socket);
+    void processLines(QLocalSocket * socket, QByteArray &input);
+
+    // disconnects a client that sent a line
+    // longer than the server accepts
+    void dropClient(QLocalSocket * socket);
+
+    AdminRasterIndex &m_index;
+    QLocalServer m_server;
+    QVector<QByteArray> m_listRegionLines;
+
+    // input received after the last complete line
+    QHash<QLocalSocket*,QByteArray> m_tablePartialInput;
+
+    // reused for every request
+    QVector<double> m_listLonLat;
+    QVector<int> m_listIds;
+    QByteArray m_output;
+};
+
+#endif // LOOKUPSERVER_H
@@ -1,3 +1,3 @@
 TEMPLATE = subdirs
 CONFIG += ordered
-SUBDIRS = shp2adminraster lookup
+SUBDIRS = adminraster shp2adminraster lookup tests
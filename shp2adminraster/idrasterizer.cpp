@@ -0,0 +1,188 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include <algorithm>
+#include <cmath>
+
+#include "idrasterizer.h"
+
+namespace
+{
+    int const kFixedShift = 32;
+    qint64 const kFixedOne = Q_INT64_C(1) << kFixedShift;
+    qint64 const kFixedHalf = kFixedOne >> 1;
+
+    // edges can't be stepped further than this many pixels
+    // per row without overflowing; steeper (near horizontal)
+    // edges only ever cover a single row
+    double const kMaxSlope = 1E8;
+
+    // ceil(x - 0.5) for a 32.32 value, which is the first
+    // pixel whose center is at or to the right of x
+    inline int firstCenterAtOrAfter(qint64 x)
+    {
+        return int((x - kFixedHalf + kFixedOne - 1) >> kFixedShift);
+    }
+}
+
+IdRasterizer::IdRasterizer() :
+    m_ids(NULL),
+    m_width(0),
+    m_height(0),
+    m_scale(1),
+    m_dx(0),
+    m_dy(0)
+{
+    // empty
+}
+
+void IdRasterizer::setTarget(quint16 * ids, int width, int height)
+{
+    m_ids = ids;
+    m_width = width;
+    m_height = height;
+    m_listEdges.clear();
+}
+
+void IdRasterizer::setTransform(double scale, double dx, double dy)
+{
+    m_scale = scale;
+    m_dx = dx;
+    m_dy = dy;
+}
+
+void IdRasterizer::addRing(double const * listX,
+                           double const * listY,
+                           int count)
+{
+    if(count < 2)   {
+        return;
+    }
+
+    double x0 = listX[count-1]*m_scale + m_dx;
+    double y0 = listY[count-1]*m_scale + m_dy;
+    for(int i=0; i < count; i++)   {
+        double const x1 = listX[i]*m_scale + m_dx;
+        double const y1 = listY[i]*m_scale + m_dy;
+
+        // rows whose centers are in [top,bottom)
+        double top = y0, bottom = y1, xTop = x0, xBottom = x1;
+        int winding = 1;
+        if(y1 < y0)   {
+            std::swap(top,bottom);
+            std::swap(xTop,xBottom);
+            winding = -1;
+        }
+
+        int yStart = std::max(int(std::ceil(top-0.5)),0);
+        int yEnd = std::min(int(std::ceil(bottom-0.5)),m_height);
+        if(yStart < yEnd)   {
+            double const dxdy = (xBottom-xTop)/(bottom-top);
+            double const xStart = xTop + (yStart+0.5-top)*dxdy;
+
+            Edge edge;
+            edge.x = qint64(std::floor(xStart*kFixedOne + 0.5));
+            edge.dxdy = (std::fabs(dxdy) < kMaxSlope) ?
+                        qint64(std::floor(dxdy*kFixedOne + 0.5)) : 0;
+            edge.yStart = yStart;
+            edge.yEnd = yEnd;
+            edge.winding = winding;
+            m_listEdges.push_back(edge);
+        }
+
+        x0 = x1;
+        y0 = y1;
+    }
+}
+
+void IdRasterizer::fillPath(quint16 id, FillRule rule)
+{
+    if(m_listEdges.isEmpty())   {
+        return;
+    }
+
+    std::sort(m_listEdges.begin(),m_listEdges.end(),startsBefore);
+
+    int const numEdges = m_listEdges.size();
+    int nextEdge = 0;
+    int y = m_listEdges[0].yStart;
+    m_listActive.clear();
+
+    while(y < m_height && (nextEdge < numEdges || !m_listActive.isEmpty()))   {
+        // skip rows without any edges
+        if(m_listActive.isEmpty())   {
+            y = std::max(y,m_listEdges[nextEdge].yStart);
+        }
+
+        // add edges that start on this row
+        while(nextEdge < numEdges && m_listEdges[nextEdge].yStart == y)   {
+            m_listActive.push_back(&m_listEdges[nextEdge]);
+            nextEdge++;
+        }
+
+        // the active list stays nearly sorted from one
+        // row to the next so insertion sort it by x
+        Edge ** active = m_listActive.data();
+        int const numActive = m_listActive.size();
+        for(int i=1; i < numActive; i++)   {
+            Edge * edge = active[i];
+            int j = i;
+            while(j > 0 && active[j-1]->x > edge->x)   {
+                active[j] = active[j-1];
+                j--;
+            }
+            active[j] = edge;
+        }
+
+        // fill the spans between edges where the
+        // winding number satisfies the fill rule
+        quint16 * row = m_ids + qint64(y)*m_width;
+        int winding = 0;
+        for(int i=0; i+1 < numActive; i++)   {
+            winding += active[i]->winding;
+            bool inside = (rule == FILL_NONZERO) ? (winding != 0) : (winding & 1);
+            if(!inside)   {
+                continue;
+            }
+
+            int xStart = std::max(firstCenterAtOrAfter(active[i]->x),0);
+            int xEnd = std::min(firstCenterAtOrAfter(active[i+1]->x),m_width);
+            for(int x=xStart; x < xEnd; x++)   {
+                row[x] = id;
+            }
+        }
+
+        // step to the next row and drop edges that end
+        y++;
+        int numKept = 0;
+        for(int i=0; i < numActive; i++)   {
+            Edge * edge = active[i];
+            if(edge->yEnd > y)   {
+                edge->x += edge->dxdy;
+                active[numKept++] = edge;
+            }
+        }
+        m_listActive.resize(numKept);
+    }
+
+    m_listEdges.clear();
+}
+
+bool IdRasterizer::startsBefore(Edge const &a, Edge const &b)
+{
+    return (a.yStart < b.yStart);
+}
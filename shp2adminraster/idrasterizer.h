@@ -0,0 +1,87 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef IDRASTERIZER_H
+#define IDRASTERIZER_H
+
+// qt
+#include <QVector>
+
+enum FillRule
+{
+    FILL_NONZERO,
+    FILL_EVENODD
+};
+
+// IdRasterizer fills polygons into a row major buffer of
+// 16-bit ids without any antialiasing, so every pixel ends
+// up with exactly one id. A pixel is inside a polygon if its
+// center is; centers that land exactly on a left edge or a
+// top edge are inside and ones on a right or bottom edge
+// are not, so polygons that share an edge never overlap.
+// Edges are stepped a scanline at a time in 32.32 fixed
+// point so the result doesn't depend on the order in which
+// edges were added
+class IdRasterizer
+{
+public:
+    IdRasterizer();
+
+    // ids must hold width*height values and outlive
+    // any fills into it
+    void setTarget(quint16 * ids, int width, int height);
+
+    // maps path coordinates to pixels with
+    // px = x*scale + dx, py = y*scale + dy
+    void setTransform(double scale, double dx, double dy);
+
+    // adds a ring to the current path; rings are implicitly
+    // closed and only edges that cross the target are kept
+    void addRing(double const * listX,
+                 double const * listY,
+                 int count);
+
+    // fills the current path with id and clears it
+    void fillPath(quint16 id, FillRule rule=FILL_NONZERO);
+
+private:
+    struct Edge
+    {
+        qint64 x;       // at the center of the current row, 32.32
+        qint64 dxdy;    // per row, 32.32
+        int yStart;     // first row
+        int yEnd;       // one past the last row
+        int winding;    // +1 going down, -1 going up
+    };
+
+    static bool startsBefore(Edge const &a, Edge const &b);
+
+    quint16 * m_ids;
+    int m_width;
+    int m_height;
+
+    double m_scale;
+    double m_dx;
+    double m_dy;
+
+    // edge table sorted by yStart when filling, and the
+    // edges that cross the current row sorted by x
+    QVector<Edge> m_listEdges;
+    QVector<Edge*> m_listActive;
+};
+
+#endif // IDRASTERIZER_H
@@ -15,17 +15,26 @@
 */
 
 #include <exception>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
 
 // qt
 #include <QCoreApplication>
 #include <QStringList>
 #include <QDebug>
-#include <QImage>
-#include <QPainter>
 #include <QDir>
 #include <QFile>
 #include <QBuffer>
 #include <QTextCodec>
+#include <QHash>
+#include <QPair>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
 
 // shapelib
 #include "shapefil.h"
@@ -37,17 +46,39 @@
 #include "KompexSQLiteException.h"
 #include "KompexSQLiteBlob.h"
 
-bool g_optimize = false;
-
-// 2d vector with color data
-struct Vec2d
+// adminraster
+#include "tilecodec.h"
+#include "flatraster.h"
+#include "rastergrid.h"
+#include "regiongeometry.h"
+
+#include "idrasterizer.h"
+
+int g_effort = kTileEffortDefault;
+bool g_flat = false;
+int g_numThreads = 1;
+TileFormat g_tileFormat = TILE_FORMAT_BLOCK16;
+TileFormat g_flatFormat = TILE_FORMAT_BLOCK16;
+RasterGrid g_grid;  // tile layout, see rastergrid.h
+int g_refine = 1;   // resolution multiplier for mixed blocks
+bool g_geometry = false;
+
+// polygon rings kept in flat arrays; ring i has the
+// vertices [listRingStart[i],listRingStart[i+1]) and
+// belongs to record listRingRecord[i], which is filled
+// with the record index as its id
+struct PolyStore
 {
-    Vec2d(double sx=0,double sy=0,QColor cy=QColor())
-    {   x = sx;   y = sy;   c = cy;   }
+    PolyStore() : numRecords(0) {}
+
+    QVector<double> listX;
+    QVector<double> listY;
+    QVector<int> listRingStart;     // ringCount()+1 entries
+    QVector<int> listRingRecord;
+    int numRecords;
 
-    double x;
-    double y;
-    QColor c;
+    int ringCount() const
+    {   return listRingRecord.size();   }
 };
 
 bool getAdmin1TranslationSubs(QString const &pathFile,
@@ -80,7 +111,7 @@ bool getAdmin1TranslationSubs(QString const &pathFile,
 }
 
 bool getPolysFromShapefile(QString const &fileShp,
-                           QList<QList<Vec2d> > &listPolygons)
+                           PolyStore &polys)
 {
     SHPHandle hSHP = SHPOpen(fileShp.toLocal8Bit().data(),"rb");
     if(hSHP == NULL)   {
@@ -95,6 +126,11 @@ bool getPolysFromShapefile(QString const &fileShp,
     }
 
     size_t nRecords = hSHP->nRecords;
+    if(nRecords >= kTileNoRegion)   {
+        qDebug() << "ERROR: Too many records to store as 16-bit ids";
+        return false;
+    }
+
     double xMax = hSHP->adBoundsMax[0];
     double yMax = hSHP->adBoundsMax[1];
     double xMin = hSHP->adBoundsMin[0];
@@ -104,48 +140,41 @@ bool getPolysFromShapefile(QString const &fileShp,
     qDebug() << "INFO: Found " << nRecords << "POLYGONS";
     qDebug() << "INFO: Reading in data...";
 
-    qDebug() << "INFO: Creating color list...";
-    QStringList listColors;
-    for(size_t i=0; i < nRecords; i++)   {
-        QString strColor = QString::number(i,16);
-        while(strColor.length() < 6)   {    // pad with zeros
-            strColor.prepend("0");
-        }
-        strColor.prepend("#");
-        listColors.push_back(strColor);
-    }
-
-    // create a list of polygons we can paint
-    SHPObject * pSHPObj;
+    // the id of each record is its index
+    polys.numRecords = nRecords;
 
+    // append the rings of every record to the store
+    polys.listRingStart.push_back(0);
     for(size_t i=0; i < nRecords; i++)
     {   // for each object
-        pSHPObj = SHPReadObject(hSHP,i);
-        size_t nParts = pSHPObj->nParts;
+        SHPObject * pSHPObj = SHPReadObject(hSHP,i);
+        if(pSHPObj == NULL)   {
+            qDebug() << "ERROR: Could not read shape" << i;
+            SHPClose(hSHP);
+            return false;
+        }
 
-        // build a list of start and end pts
-        QList<int> listStartPts;
-        QList<int> listEndB4Pts;
-        for(size_t j=0; j < nParts-1; j++)   {
-            listStartPts.push_back(pSHPObj->panPartStart[j]);
-            listEndB4Pts.push_back(pSHPObj->panPartStart[j+1]);
+        int const nVertices = pSHPObj->nVertices;
+        int const offset = polys.listX.size();
+        polys.listX.resize(offset+nVertices);
+        polys.listY.resize(offset+nVertices);
+        double * x = polys.listX.data()+offset;
+        double * y = polys.listY.data()+offset;
+        for(int k=0; k < nVertices; k++)   {
+            x[k] = pSHPObj->padfX[k]+180;
+            y[k] = (pSHPObj->padfY[k]-90)*-1;
         }
-        listStartPts.push_back(pSHPObj->panPartStart[nParts-1]);
-        listEndB4Pts.push_back(pSHPObj->nVertices);
 
-        // build polys from start/end pts
-        for(int j=0; j < listStartPts.size(); j++)
-        {
-            QList<Vec2d> listPts;
-            size_t sIx = listStartPts[j];
-            size_t eIx = listEndB4Pts[j];
-
-            for(size_t k=sIx; k < eIx; k++)   {
-                listPts.push_back(Vec2d(pSHPObj->padfX[k]+180,
-                                       (pSHPObj->padfY[k]-90)*-1,
-                                        QColor(listColors[i])));
+        // each part is a ring that runs up to
+        // the start of the next part
+        for(int j=0; j < pSHPObj->nParts; j++)   {
+            int eIx = (j+1 < pSHPObj->nParts) ?
+                        pSHPObj->panPartStart[j+1] : nVertices;
+            if(eIx <= pSHPObj->panPartStart[j])   {
+                continue;
             }
-            listPolygons.push_back(listPts);
+            polys.listRingStart.push_back(offset+eIx);
+            polys.listRingRecord.push_back(i);
         }
         SHPDestroyObject(pSHPObj);
     }
@@ -154,400 +183,865 @@ bool getPolysFromShapefile(QString const &fileShp,
     return true;
 }
 
-bool rasterizePolygons(QString const &outputFolder,
-                       QList<QList<Vec2d> > const &listPolygons)
+// builds a quadtree over the bounding box of every
+// poly so each tile only has to look at the polys that
+// overlap it; shape ids in the tree are poly indices
+SHPTree * buildPolyIndex(PolyStore const &polys)
 {
-    qDebug() << "INFO: Rasterizing polys to images in" << outputFolder;
-    int kSzMult=100;
+    qDebug() << "INFO: Indexing" << polys.ringCount() << "polys...";
+
+    // polys are in the range x: [0,360], y: [0,180]
+    double boundsMin[2] = { 0,0 };
+    double boundsMax[2] = { 360,180 };
+    SHPTree * polyIndex = SHPCreateTree(NULL,2,12,boundsMin,boundsMax);
+    if(polyIndex == NULL)   {
+        qDebug() << "ERROR: Could not create poly index";
+        return NULL;
+    }
 
-    QImage shImage1(180*kSzMult,180*kSzMult,
-                   QImage::Format_RGB888);
+    // the tree only needs the id and the
+    // bounds of each shape, not its vertices
+    SHPObject * pSHPObj = SHPCreateSimpleObject(SHPT_POLYGON,0,NULL,NULL,NULL);
+    for(int i=0; i < polys.ringCount(); i++)   {
+        int const sIx = polys.listRingStart[i];
+        int const eIx = polys.listRingStart[i+1];
+        double minx = polys.listX[sIx];   double maxx = minx;
+        double miny = polys.listY[sIx];   double maxy = miny;
+        for(int j=sIx+1; j < eIx; j++)   {
+            minx = std::min(minx,polys.listX[j]);
+            maxx = std::max(maxx,polys.listX[j]);
+            miny = std::min(miny,polys.listY[j]);
+            maxy = std::max(maxy,polys.listY[j]);
+        }
 
-    QImage shImage2(180*kSzMult,180*kSzMult,
-                   QImage::Format_RGB888);
+        pSHPObj->nShapeId = i;
+        pSHPObj->dfXMin = minx;   pSHPObj->dfXMax = maxx;
+        pSHPObj->dfYMin = miny;   pSHPObj->dfYMax = maxy;
+        pSHPObj->dfZMin = 0;      pSHPObj->dfZMax = 0;
+        pSHPObj->dfMMin = 0;      pSHPObj->dfMMax = 0;
+
+        if(!SHPTreeAddShapeId(polyIndex,pSHPObj))   {
+            qDebug() << "ERROR: Could not index poly" << i;
+            SHPDestroyObject(pSHPObj);
+            SHPDestroyTree(polyIndex);
+            return NULL;
+        }
+    }
+    SHPDestroyObject(pSHPObj);
 
-    shImage1.fill(Qt::white);
-    shImage2.fill(Qt::white);
+    return polyIndex;
+}
 
-    // setup painter
-    QPainter shPainter;
-    QBrush shBrush(Qt::blue);
+// a tile encoded for the tiles table and, if the
+// raster is refined, for the refined table
+struct EncodedTile
+{
+    int idx;
+    QByteArray data;
+    QByteArray refined;     // empty if nothing was refined
+};
+
+bool encodeTile(QVector<quint16> const &listIds,
+                int tile_idx,
+                FlatRasterWriter * flatWriter,
+                QByteArray &tileData)
+{
+    if(flatWriter)   {
+        if(!flatWriter->writeTile(tile_idx,listIds))   {
+            return false;
+        }
+    }
+
+    return encodeTileIds(listIds,g_grid.tileSize,g_tileFormat,tileData,g_effort);
+}
 
-    // draw polys on image 1
-    shPainter.begin(&shImage1);
-    shPainter.setPen(Qt::NoPen);
-    for(int i=0; i < listPolygons.size(); i++)
+// bounded queue of encoded tiles between the threads
+// rendering tiles and the thread writing them to the
+// database; producers block while it's full
+class TileQueue
+{
+public:
+    TileQueue(int capacity) :
+        m_capacity(capacity),
+        m_closed(false)
+    {}
+
+    // returns false if the queue was closed
+    bool push(EncodedTile const &tile)
     {
-        QPainterPath pPath;
-        pPath.setFillRule(Qt::WindingFill);
-        pPath.moveTo(listPolygons[i][0].x*kSzMult,
-                     listPolygons[i][0].y*kSzMult);
+        QMutexLocker locker(&m_mutex);
+        while(!m_closed && m_listTiles.size() >= m_capacity)   {
+            m_notFull.wait(&m_mutex);
+        }
+        if(m_closed)   {
+            return false;
+        }
+        m_listTiles.push_back(tile);
+        m_notEmpty.wakeOne();
+        return true;
+    }
 
-        for(int j=0; j < listPolygons[i].size(); j++)   {
-            pPath.lineTo(listPolygons[i][j].x*kSzMult,
-                         listPolygons[i][j].y*kSzMult);
+    // returns false once the queue is closed and empty
+    bool pop(EncodedTile &tile)
+    {
+        QMutexLocker locker(&m_mutex);
+        while(!m_closed && m_listTiles.isEmpty())   {
+            m_notEmpty.wait(&m_mutex);
+        }
+        if(m_listTiles.isEmpty())   {
+            return false;
         }
-        pPath.closeSubpath();
+        tile = m_listTiles.takeFirst();
+        m_notFull.wakeOne();
+        return true;
+    }
 
-        shBrush.setColor(listPolygons[i][0].c);
-        shPainter.setBrush(shBrush);
-        shPainter.drawPath(pPath);
+    // wakes up everything waiting on the queue; tiles
+    // already queued can still be popped
+    void close()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_closed = true;
+        m_notFull.wakeAll();
+        m_notEmpty.wakeAll();
     }
-    shPainter.end();
 
-    // draw polys on image2
-    shPainter.begin(&shImage2);
-    shPainter.setPen(Qt::NoPen);
-    for(int i=0; i < listPolygons.size(); i++)
+private:
+    QMutex m_mutex;
+    QWaitCondition m_notFull;
+    QWaitCondition m_notEmpty;
+    QList<EncodedTile> m_listTiles;
+    int m_capacity;
+    bool m_closed;
+};
+
+// state shared by the threads rendering tiles; everything
+// other than the counters and the queue is read only
+struct RasterizeJob
+{
+    PolyStore const * polys;
+    SHPTree * polyIndex;
+    FlatRasterWriter * flatWriter;
+    TileQueue * tileQueue;
+
+    QAtomicInt nextTile;
+    QAtomicInt tasksRunning;
+    QAtomicInt failed;
+};
+
+// renders tiles from a RasterizeJob until there are none left;
+// each task has its own id buffers and rasterizer
+class RasterizeTask : public QRunnable
+{
+public:
+    RasterizeTask(RasterizeJob * job) :
+        m_job(job)
+    {
+        setAutoDelete(true);
+    }
+
+    void run()
     {
-        QPainterPath pPath;
-        pPath.setFillRule(Qt::WindingFill);
-        pPath.moveTo(listPolygons[i][0].x*kSzMult - 180*kSzMult,
-                     listPolygons[i][0].y*kSzMult);
+        int const tileSize = g_grid.tileSize;
+        int const tileCount = g_grid.tileCount();
+        double const res = g_grid.resolution;
 
-        for(int j=0; j < listPolygons[i].size(); j++)   {
-            pPath.lineTo(listPolygons[i][j].x*kSzMult - 180*kSzMult,
-                         listPolygons[i][j].y*kSzMult);
+        QVector<quint16> listIds;
+        while(!m_job->failed)
+        {
+            int t = m_job->nextTile.fetchAndAddRelaxed(1);
+            if(t >= tileCount)   {
+                break;
+            }
+
+            // top left corner of the tile in pixels
+            int tileX,tileY;
+            g_grid.getTileOrigin(t,tileX,tileY);
+
+            // find the polys whose bounding boxes overlap
+            // this tile; they're filled in their original
+            // order so later records win where they overlap
+            double tileMin[2] = { tileX/res, tileY/res };
+            double tileMax[2] = { (tileX+tileSize)/res,
+                                  (tileY+tileSize)/res };
+            int numPolys = 0;
+            int * listPolys = SHPTreeFindLikelyShapes(m_job->polyIndex,
+                                                      tileMin,tileMax,
+                                                      &numPolys);
+            std::sort(listPolys,listPolys+numPolys);
+            m_listPolys.clear();
+            for(int n=0; n < numPolys; n++)   {
+                m_listPolys.push_back(listPolys[n]);
+            }
+            free(listPolys);
+
+            listIds.fill(kTileNoRegion,tileSize*tileSize);
+            m_rasterizer.setTarget(listIds.data(),tileSize,tileSize);
+            m_rasterizer.setTransform(res,-tileX,-tileY);
+            fillPolys();
+
+            EncodedTile encoded;
+            encoded.idx = t;
+            if(!encodeTile(listIds,t,m_job->flatWriter,encoded.data) ||
+               (g_refine > 1 && !refineTile(listIds,tileX,tileY,encoded.refined)))   {
+                qDebug() << "ERROR: Could not encode tile" << t;
+                m_job->failed = 1;
+                break;
+            }
+
+            if(!m_job->tileQueue->push(encoded))   {
+                break;
+            }
+        }
+
+        // the last task to finish lets the writer know there
+        // won't be any more tiles (or that one failed)
+        if(!m_job->tasksRunning.deref() || m_job->failed)   {
+            m_job->tileQueue->close();
         }
-        pPath.closeSubpath();
+    }
 
-        shBrush.setColor(listPolygons[i][0].c);
-        shPainter.setBrush(shBrush);
-        shPainter.drawPath(pPath);
+private:
+    // fills the polys in m_listPolys with the current target
+    // and transform; all the rings of a record are filled as
+    // one path so holes are left empty
+    void fillPolys()
+    {
+        PolyStore const &polys = *(m_job->polys);
+        for(int n=0; n < m_listPolys.size(); n++)   {
+            int i = m_listPolys[n];
+            int const sIx = polys.listRingStart[i];
+            int const eIx = polys.listRingStart[i+1];
+            m_rasterizer.addRing(polys.listX.constData()+sIx,
+                                 polys.listY.constData()+sIx,
+                                 eIx-sIx);
+
+            int record = polys.listRingRecord[i];
+            if(n+1 == m_listPolys.size() ||
+               polys.listRingRecord[m_listPolys[n+1]] != record)   {
+                m_rasterizer.fillPath(quint16(record),FILL_NONZERO);
+            }
+        }
     }
-    shPainter.end();
 
-    QString fname1 = outputFolder + "/imgW.png";
-    QString fname2 = outputFolder + "/imgE.png";
+    // fills every mixed block of a tile again at g_refine
+    // times the resolution; each row of blocks is filled
+    // into a strip that's the width of the tile so the polys
+    // only have to be filled once per row that needs it
+    bool refineTile(QVector<quint16> const &listIds,
+                    int tileX, int tileY,
+                    QByteArray &refinedData)
+    {
+        int const tileSize = g_grid.tileSize;
+        int const factor = g_refine;
+        int const blocksPerSide = tileSize/kTileBlockSize;
+        int const fineBlockSize = kTileBlockSize*factor;
+        int const fineWidth = tileSize*factor;
+        double const fineRes = double(g_grid.resolution)*factor;
+
+        QVector<quint32> listBlockIds;
+        QVector<quint16> listFineIds;
+        QVector<int> listMixedCols;
+
+        for(int by=0; by < blocksPerSide; by++)   {
+            // find the mixed blocks in this row
+            listMixedCols.clear();
+            for(int bx=0; bx < blocksPerSide; bx++)   {
+                quint16 const * block = listIds.constData() +
+                        by*kTileBlockSize*tileSize + bx*kTileBlockSize;
+                bool mixed = false;
+                for(int y=0; y < kTileBlockSize && !mixed; y++)   {
+                    quint16 const * line = block + y*tileSize;
+                    for(int x=0; x < kTileBlockSize; x++)   {
+                        if(line[x] != block[0])   {
+                            mixed = true;
+                            break;
+                        }
+                    }
+                }
+                if(mixed)   {
+                    listMixedCols.push_back(bx);
+                }
+            }
+            if(listMixedCols.isEmpty())   {
+                continue;
+            }
 
-    if(shImage1.save(fname1) && shImage2.save(fname2))   {
-        qDebug() << "INFO: Saved images as" << fname1
-                 << "and" << fname2;
+            m_listStripIds.fill(kTileNoRegion,fineWidth*fineBlockSize);
+            m_rasterizer.setTarget(m_listStripIds.data(),fineWidth,fineBlockSize);
+            m_rasterizer.setTransform(fineRes,
+                                      -double(tileX)*factor,
+                                      -double(tileY)*factor - by*fineBlockSize);
+            fillPolys();
+
+            for(int i=0; i < listMixedCols.size(); i++)   {
+                int bx = listMixedCols[i];
+                listBlockIds.push_back(by*blocksPerSide + bx);
+                for(int y=0; y < fineBlockSize; y++)   {
+                    quint16 const * line = m_listStripIds.constData() +
+                            y*fineWidth + bx*fineBlockSize;
+                    for(int x=0; x < fineBlockSize; x++)   {
+                        listFineIds.push_back(line[x]);
+                    }
+                }
+            }
+        }
+
+        refinedData.clear();
+        if(listBlockIds.isEmpty())   {
+            return true;
+        }
+
+        QByteArray blockData;
+        if(!encodeRefinedTile(listBlockIds,listFineIds,factor,blockData))   {
+            return false;
+        }
+        refinedData = qCompress(blockData,(g_effort < 0) ? 9 : g_effort);
         return true;
     }
 
-    qDebug() << "ERROR: Could not save images";
-    return false;
-}
+    IdRasterizer m_rasterizer;
+    QVector<int> m_listPolys;
+    QVector<quint16> m_listStripIds;
+    RasterizeJob * m_job;
+};
 
-bool splitImageIntoTiles(QImage const &img,
-                         QString const &pathTiles,
-                         QStringList &listTileFiles)
+bool rasterizeTiles(PolyStore const &polys,
+                    SHPTree * polyIndex,
+                    FlatRasterWriter * flatWriter,
+                    Kompex::SQLiteDatabase * pDatabase)
 {
-    QString prefix = "tile_";
-    QString postfix = ".png";
-
-    if(pathTiles.at(pathTiles.size()-1) != '/')   {
-        prefix.prepend("/");
+    qDebug() << "INFO: Rasterizing polys to tiles using"
+             << g_numThreads << "threads";
+
+    // polys are rendered into one tile at a time instead of
+    // into a pair of 18000x18000 images that are then cut up;
+    // tiles are independent so they're rendered in parallel
+    // and encoded tiles are passed straight to this thread
+    // to be written to the database
+    TileQueue tileQueue(g_numThreads*2);
+
+    RasterizeJob job;
+    job.polys = &polys;
+    job.polyIndex = polyIndex;
+    job.flatWriter = flatWriter;
+    job.tileQueue = &tileQueue;
+    job.tasksRunning = g_numThreads;
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(g_numThreads);
+    for(int i=0; i < g_numThreads; i++)   {
+        pool.start(new RasterizeTask(&job));
     }
 
-    size_t idx=0;
-    for(size_t i=0; i < 18; i++)   {        // along y (lat)
-        for(size_t j=0; j < 18; j++)   {    // along x (lon)
-            int xMin = (j)*1000;
-            int yMin = (i)*1000;
-            QImage tile = img.copy(xMin,yMin,1000,1000);
-            QString filename = pathTiles + prefix +
-                    QString::number(idx,10) + postfix;
+    // all tiles are written in one transaction
+    // with a single prepared statement
+    Kompex::SQLiteStatement stmtTransaction(pDatabase);
+    Kompex::SQLiteStatement stmtInsert(pDatabase);
 
-            if(!tile.save(filename))   {
-                return false;
+    Kompex::SQLiteStatement stmtInsertRefined(pDatabase);
+
+    int const tileCount = g_grid.tileCount();
+    int const kProgressSteps = 100;
+    int tilesDone = 0;
+    try   {
+        stmtInsert.Sql("INSERT INTO tiles(id,data) VALUES(?,?);");
+        if(g_refine > 1)   {
+            stmtInsertRefined.Sql("INSERT INTO refined(id,data) VALUES(?,?);");
+        }
+        stmtTransaction.BeginTransaction();
+
+        EncodedTile tile;
+        while(tileQueue.pop(tile))   {
+            stmtInsert.BindInt(1,tile.idx);
+            stmtInsert.BindBlob(2,tile.data.constData(),tile.data.size());
+            stmtInsert.Execute();
+            stmtInsert.Reset();
+
+            if(!tile.refined.isEmpty())   {
+                stmtInsertRefined.BindInt(1,tile.idx);
+                stmtInsertRefined.BindBlob(2,tile.refined.constData(),tile.refined.size());
+                stmtInsertRefined.Execute();
+                stmtInsertRefined.Reset();
             }
 
-            // optimize
-            if(g_optimize)   {
-                QString syscmd = "optipng -silent " + filename;
-                if(system(syscmd.toLocal8Bit().data()) < 0)   {
-                    qDebug() << "WARN: Failed to optimize" << filename;
-                }
+            // progress is logged every kProgressSteps'th
+            // of the way instead of once per tile
+            tilesDone++;
+            if(qint64(tilesDone)*kProgressSteps/tileCount !=
+               qint64(tilesDone-1)*kProgressSteps/tileCount)   {
+                qDebug() << "INFO: Wrote" << tilesDone << "of" << tileCount << "tiles";
             }
+        }
 
-            idx++;
-            listTileFiles.push_back(filename);
-            qDebug() << "INFO: Wrote" << idx << "of 324 tiles";
+        stmtTransaction.CommitTransaction();
+        stmtInsert.FreeQuery();
+        if(g_refine > 1)   {
+            stmtInsertRefined.FreeQuery();
         }
     }
-    return true;
+    catch(Kompex::SQLiteException &exception)   {
+        qDebug() << "ERROR: SQLite exception writing tile data:"
+                 << QString::fromStdString(exception.GetString());
+        job.failed = 1;
+        tileQueue.close();
+    }
+    pool.waitForDone();
+
+    return (!job.failed && tilesDone == tileCount);
 }
 
-bool writeTilesToDatabase(QStringList const &listTileFiles,
-                          Kompex::SQLiteStatement * pStmt)
+// admin0 attributes from the admin0 dbf
+struct Admin0Record
 {
+    QString adm_a3;
+    QString sov_a3;
+    QString adm_name;
+    QString sov_name;
+    QString type;
+    QString note;
+};
 
-    for(int i=0; i < listTileFiles.size(); i++)   {
+// admin1 attributes from the admin1 dbf
+struct Admin1Record
+{
+    QString name;
+    QString adm_a3;
+    QString sov_a3;
+};
 
-        QFile tileFile(listTileFiles[i]);
-        if(!tileFile.open(QIODevice::ReadOnly))   {
-            qDebug() << "ERROR: Could not open tile file"
-                     << listTileFiles[i];
-            return false;
+// an admin1 region resolved against admin0
+struct Admin1Region
+{
+    int admin0;     // -1 if there's no admin0 region
+    int sov;
+    bool disputed;
+};
+
+// drops every vertex of a ring that's closer than tolerance
+// to the last vertex that was kept; the first vertex is
+// always kept so the ring stays closed
+void simplifyRing(double const * x, double const * y, int count,
+                  double tolerance,
+                  QVector<double> &listX,
+                  QVector<double> &listY)
+{
+    double const tol2 = tolerance*tolerance;
+    double lastX = x[0];
+    double lastY = y[0];
+    listX.push_back(lastX);
+    listY.push_back(lastY);
+
+    for(int i=1; i < count; i++)   {
+        double dx = x[i]-lastX;
+        double dy = y[i]-lastY;
+        if(dx*dx + dy*dy >= tol2)   {
+            lastX = x[i];
+            lastY = y[i];
+            listX.push_back(lastX);
+            listY.push_back(lastY);
         }
+    }
+}
 
-        QByteArray pngBlob = tileFile.readAll();
-        try   {
-            pStmt->Sql("INSERT INTO tiles(id,png) VALUES(?,?)");
-            pStmt->BindInt(1,i);
-            pStmt->BindBlob(2,pngBlob.data(),pngBlob.size());
-            pStmt->ExecuteAndFree();
+// finds a label point for a region; rings are tried from
+// the largest to the smallest and the first point that is
+// inside the region itself (and not in one of its holes)
+// is used. Returns false if there isn't one
+bool getRegionLabelPoint(QVector<double> const &listX,
+                         QVector<double> const &listY,
+                         QVector<int> const &listRingStart,
+                         RegionGeometry const &geometry,
+                         double &x, double &y)
+{
+    // (area, ring) for every ring
+    QVector<std::pair<double,int> > listRingAreas;
+    for(int i=0; i+1 < listRingStart.size(); i++)   {
+        double area = 0;
+        int const sIx = listRingStart[i];
+        int const eIx = listRingStart[i+1];
+        for(int k=sIx, j=eIx-1; k < eIx; j=k++)   {
+            area += listX[j]*listY[k] - listX[k]*listY[j];
         }
-        catch(Kompex::SQLiteException &exception)   {
-            qDebug() << "ERROR: SQLite exception writing tile data:"
-                     << QString::fromStdString(exception.GetString());
-            return false;
+        listRingAreas.push_back(std::make_pair(std::fabs(area),i));
+    }
+    std::sort(listRingAreas.begin(),listRingAreas.end());
+
+    for(int i=listRingAreas.size()-1; i >= 0; i--)   {
+        int const ring = listRingAreas[i].second;
+        int const sIx = listRingStart[ring];
+        if(getPointInRing(listX.constData()+sIx,listY.constData()+sIx,
+                          listRingStart[ring+1]-sIx,x,y) &&
+           geometry.contains(x,y))   {
+            return true;
+        }
+    }
+    return false;
+}
+
+// writes the rings of each record to the geometry table so
+// lookups on boundary pixels can be resolved exactly; rings
+// are simplified to a small fraction of the finest pixel.
+// Each row also gets a label point inside the region
+bool writeGeometryToDatabase(PolyStore const &polys,
+                             Kompex::SQLiteDatabase * pDatabase)
+{
+    double const tolerance = 1.0/(16.0*g_grid.resolution*g_refine);
+    int const numRecords = polys.numRecords;
+
+    // rings are stored in record order
+    QVector<int> listRecordRingStart(numRecords+1,0);
+    for(int i=0; i < polys.ringCount(); i++)   {
+        listRecordRingStart[polys.listRingRecord[i]+1] = i+1;
+    }
+    for(int r=0; r < numRecords; r++)   {
+        listRecordRingStart[r+1] = std::max(listRecordRingStart[r+1],
+                                            listRecordRingStart[r]);
+    }
+
+    Kompex::SQLiteStatement stmtInsert(pDatabase);
+    Kompex::SQLiteStatement stmtTransaction(pDatabase);
+    qint64 numVertices = 0;
+    int numLabels = 0;
+    try   {
+        stmtInsert.Sql("INSERT INTO geometry(id,data,label_lon,label_lat) "
+                       "VALUES(?,?,?,?);");
+        stmtTransaction.BeginTransaction();
+
+        QVector<double> listX,listY;
+        QVector<int> listRingStart;
+        QByteArray geometryData;
+        RegionGeometry geometry;
+        for(int r=0; r < numRecords; r++)   {
+            listX.clear();
+            listY.clear();
+            listRingStart.clear();
+            listRingStart.push_back(0);
+
+            for(int i=listRecordRingStart[r]; i < listRecordRingStart[r+1]; i++)   {
+                int const sIx = polys.listRingStart[i];
+                int const eIx = polys.listRingStart[i+1];
+                simplifyRing(polys.listX.constData()+sIx,
+                             polys.listY.constData()+sIx,
+                             eIx-sIx,tolerance,listX,listY);
+                listRingStart.push_back(listX.size());
+            }
+            if(listRingStart.size() < 2)   {
+                continue;
+            }
+
+            if(!encodeRegionGeometry(listX,listY,listRingStart,geometryData))   {
+                qDebug() << "ERROR: Could not encode geometry for region" << r;
+                return false;
+            }
+            numVertices += listX.size();
+
+            stmtInsert.BindInt(1,r);
+            stmtInsert.BindBlob(2,geometryData.constData(),geometryData.size());
+
+            double labelX,labelY;
+            if(geometry.decode(geometryData) &&
+               getRegionLabelPoint(listX,listY,listRingStart,geometry,
+                                   labelX,labelY))   {
+                stmtInsert.BindDouble(3,labelX-180.0);
+                stmtInsert.BindDouble(4,90.0-labelY);
+                numLabels++;
+            }
+            else   {
+                stmtInsert.BindNull(3);
+                stmtInsert.BindNull(4);
+            }
+            stmtInsert.Execute();
+            stmtInsert.Reset();
         }
+
+        stmtTransaction.CommitTransaction();
+        stmtInsert.FreeQuery();
+    }
+    catch(Kompex::SQLiteException &exception)   {
+        qDebug() << "ERROR: SQLite exception writing geometry:"
+                 << QString::fromStdString(exception.GetString());
+        return false;
     }
+
+    qDebug() << "INFO: Wrote" << numVertices << "of"
+             << polys.listX.size() << "vertices to the geometry table";
+    qDebug() << "INFO: Found label points for" << numLabels << "regions";
     return true;
 }
 
-bool writeAdminRegionsToDatabase(QString const &a0_dbf,
-                                 QString const &a1_dbf,
-                                 Kompex::SQLiteStatement * pStmt)
+bool readAdmin0Records(QString const &a0_dbf,
+                       QTextCodec * codec,
+                       QList<Admin0Record> &listAdmin0)
 {
-    // because shapefiles are evil
-    QTextCodec * codec = QTextCodec::codecForName("windows-1252");
+    DBFHandle a0_hDBF = DBFOpen(a0_dbf.toLocal8Bit().data(),"rb");
+    if(a0_hDBF == NULL)   {
+        qDebug() << "ERROR: Could not open admin0 dbf file";
+        return false;
+    }
 
-    // populate the admin0 temp table
-    {
-        DBFHandle a0_hDBF = DBFOpen(a0_dbf.toLocal8Bit().data(),"rb");
-        if(a0_hDBF == NULL)   {
-            qDebug() << "ERROR: Could not open admin0 dbf file";
-            return -1;
+    size_t a0_numRecords = DBFGetRecordCount(a0_hDBF);
+    if(a0_numRecords == 0)   {
+        qDebug() << "ERROR: admin0 dbf file has no records!";
+        DBFClose(a0_hDBF);
+        return false;
+    }
+
+    size_t a0_idx_adm_name  = DBFGetFieldIndex(a0_hDBF,"name");
+    size_t a0_idx_adm_a3    = DBFGetFieldIndex(a0_hDBF,"adm0_a3");
+    size_t a0_idx_sov_name  = DBFGetFieldIndex(a0_hDBF,"sovereignt");
+    size_t a0_idx_sov_a3    = DBFGetFieldIndex(a0_hDBF,"sov_a3");
+    size_t a0_idx_type      = DBFGetFieldIndex(a0_hDBF,"type");
+    size_t a0_idx_note      = DBFGetFieldIndex(a0_hDBF,"note_adm0");
+
+    for(size_t i=0; i < a0_numRecords; i++)   {
+        Admin0Record a0;
+        a0.adm_a3   = codec->toUnicode(DBFReadStringAttribute(a0_hDBF, i, a0_idx_adm_a3));
+        a0.sov_a3   = codec->toUnicode(DBFReadStringAttribute(a0_hDBF, i, a0_idx_sov_a3));
+        a0.adm_name = codec->toUnicode(DBFReadStringAttribute(a0_hDBF, i, a0_idx_adm_name));
+        a0.sov_name = codec->toUnicode(DBFReadStringAttribute(a0_hDBF, i, a0_idx_sov_name));
+        a0.type     = codec->toUnicode(DBFReadStringAttribute(a0_hDBF, i, a0_idx_type));
+        a0.note     = codec->toUnicode(DBFReadStringAttribute(a0_hDBF, i, a0_idx_note));
+        listAdmin0.push_back(a0);
+    }
+    DBFClose(a0_hDBF);
+
+    return true;
+}
+
+bool readAdmin1Records(QString const &a1_dbf,
+                       QTextCodec * codec,
+                       QList<Admin1Record> &listAdmin1)
+{
+    DBFHandle a1_hDBF = DBFOpen(a1_dbf.toLocal8Bit().data(),"rb");
+    if(a1_hDBF == NULL)   {
+        qDebug() << "ERROR: Could not open admin1 dbf file";
+        return false;
+    }
+
+    size_t a1_numRecords = DBFGetRecordCount(a1_hDBF);
+    if(a1_numRecords == 0)   {
+        qDebug() << "ERROR: admin1 dbf file has no records!";
+        DBFClose(a1_hDBF);
+        return false;
+    }
+
+    // open admin1 translation csv if it exists
+    QStringList listAdmin1Subs;
+    QString pathSubs = a1_dbf;
+    pathSubs.chop(4);
+    pathSubs.append("_translations.dat");
+    bool admin1_csv_sub = getAdmin1TranslationSubs(pathSubs,listAdmin1Subs);
+    if(admin1_csv_sub)   {
+        if(size_t(listAdmin1Subs.size()) == a1_numRecords)   {
+            qDebug() << "INFO: Using translation substitute file: "<< pathSubs;
+        }
+        else   {
+            qDebug() << "WARN: Translation file has wrong number "
+                        "of entries: " << listAdmin1Subs.size();
+            admin1_csv_sub = false;
         }
+    }
 
-        size_t a0_numRecords = DBFGetRecordCount(a0_hDBF);
-        if(a0_numRecords == 0)   {
-            qDebug() << "ERROR: admin0 dbf file has no records!";
-            return -1;
+    size_t a1_idx_adm_name  = DBFGetFieldIndex(a1_hDBF,"name");
+    size_t a1_idx_adm_a3    = DBFGetFieldIndex(a1_hDBF,"sr_adm0_a3");
+    size_t a1_idx_sov_a3    = DBFGetFieldIndex(a1_hDBF,"sr_sov_a3");
+    size_t a1_idx_fclass    = DBFGetFieldIndex(a1_hDBF,"featurecla");
+    size_t a1_idx_adminname = DBFGetFieldIndex(a1_hDBF,"admin");
+
+    for(size_t i=0; i < a1_numRecords; i++)   {
+        Admin1Record a1;
+
+        // get the name of this admin1 entry
+        a1.name = codec->toUnicode(DBFReadStringAttribute(a1_hDBF, i, a1_idx_adm_name));
+
+        // if the adm1 fclass is an aggregation, minor island or
+        // remainder, we grab the name from another field which
+        // doesn't contain a bunch of additional metadata
+        QString fclass(codec->toUnicode(DBFReadStringAttribute(a1_hDBF, i, a1_idx_fclass)));
+        if(fclass.contains("aggregation") ||
+           fclass.contains("minor island") ||
+           fclass.contains("remainder"))
+        {
+            a1.name = codec->toUnicode(DBFReadStringAttribute(
+                                           a1_hDBF, i, a1_idx_adminname));
+        }
+        else   {
+            // if there's no special feature class than we check
+            // to see if there's a translation substitute available
+            if(admin1_csv_sub && (listAdmin1Subs[i].size() > 0))   {
+                a1.name = listAdmin1Subs[i];
+            }
         }
 
-        size_t a0_idx_adm_name  = DBFGetFieldIndex(a0_hDBF,"name");
-        size_t a0_idx_adm_a3    = DBFGetFieldIndex(a0_hDBF,"adm0_a3");
-        size_t a0_idx_sov_name  = DBFGetFieldIndex(a0_hDBF,"sovereignt");
-        size_t a0_idx_sov_a3    = DBFGetFieldIndex(a0_hDBF,"sov_a3");
-        size_t a0_idx_type      = DBFGetFieldIndex(a0_hDBF,"type");
-        size_t a0_idx_note      = DBFGetFieldIndex(a0_hDBF,"note_adm0");
+        // get the adm_a3,sov_a3 code for this admin1 entry
+        a1.adm_a3 = codec->toUnicode(DBFReadStringAttribute(a1_hDBF, i, a1_idx_adm_a3));
+        a1.sov_a3 = codec->toUnicode(DBFReadStringAttribute(a1_hDBF, i, a1_idx_sov_a3));
+        listAdmin1.push_back(a1);
+    }
+    DBFClose(a1_hDBF);
+
+    return true;
+}
 
-        // create a temporary table we can use to lookup
-        // the admin0 data we want for each admin1 entry
-        pStmt->SqlStatement("CREATE TABLE IF NOT EXISTS temp("
-                            "id INTEGER PRIMARY KEY NOT NULL UNIQUE,"
-                            "adm_a3 TEXT NOT NULL UNIQUE,"
-                            "sov_a3 TEXT NOT NULL,"
-                            "adm_name TEXT,"
-                            "sov_name TEXT,"
-                            "type TEXT,"
-                            "note TEXT);");
-
-        pStmt->BeginTransaction();
-        for(size_t i=0; i < a0_numRecords; i++)   {
-            QString s0 = QString::number(i,10);
-            QString s1(codec->toUnicode(DBFReadStringAttribute(a0_hDBF, i, a0_idx_adm_a3)));
-            QString s2(codec->toUnicode(DBFReadStringAttribute(a0_hDBF, i, a0_idx_sov_a3)));
-            QString s3(codec->toUnicode(DBFReadStringAttribute(a0_hDBF, i, a0_idx_adm_name)));
-            QString s4(codec->toUnicode(DBFReadStringAttribute(a0_hDBF, i, a0_idx_sov_name)));
-            QString s5(codec->toUnicode(DBFReadStringAttribute(a0_hDBF, i, a0_idx_type)));
-            QString s6(codec->toUnicode(DBFReadStringAttribute(a0_hDBF, i, a0_idx_note)));
-
-            QString stmt("INSERT INTO temp("
-                         "id,"
-                         "adm_a3,"
-                         "sov_a3,"
-                         "adm_name,"
-                         "sov_name,"
-                         "type,"
-                         "note) VALUES(" +
-                         s0 + "," +
-                         "\"" + s1 + "\","
-                         "\"" + s2 + "\","
-                         "\"" + s3 + "\","
-                         "\"" + s4 + "\","
-                         "\"" + s5 + "\","
-                         "\"" + s6 + "\");");
-
-            pStmt->SqlStatement(stmt.toStdString());
-        }
-        pStmt->CommitTransaction();
-        DBFClose(a0_hDBF);
+// resolves the admin0 and sov regions of every admin1 record
+// by its adm_a3 code, falling back to its sov_a3 code; admin0
+// and sov ids are indices into listAdmin0. Returns false if
+// a record doesn't match either code
+bool joinAdmin1ToAdmin0(QList<Admin0Record> const &listAdmin0,
+                        QList<Admin1Record> const &listAdmin1,
+                        QVector<Admin1Region> &listRegions)
+{
+    // the first admin0 record with a given code wins
+    QHash<QString,int> tableAdmA3;
+    QHash<QString,int> tableSovA3;
+    for(int i=0; i < listAdmin0.size(); i++)   {
+        if(!tableAdmA3.contains(listAdmin0[i].adm_a3))   {
+            tableAdmA3.insert(listAdmin0[i].adm_a3,i);
+        }
+        if(!tableSovA3.contains(listAdmin0[i].sov_a3))   {
+            tableSovA3.insert(listAdmin0[i].sov_a3,i);
+        }
     }
 
-    // populate the admin1 table
-    {
-        DBFHandle a1_hDBF = DBFOpen(a1_dbf.toLocal8Bit().data(),"rb");
-        if(a1_hDBF == NULL)   {
-            qDebug() << "ERROR: Could not open admin1 dbf file";
-            return false;
+    listRegions.resize(listAdmin1.size());
+    for(int i=0; i < listAdmin1.size(); i++)   {
+        Admin1Region &region = listRegions[i];
+
+        QHash<QString,int>::const_iterator it =
+                tableAdmA3.constFind(listAdmin1[i].adm_a3);
+
+        if(it != tableAdmA3.constEnd())   {
+            // we currently derive the disputed field
+            // from admin0 type and note fields
+            Admin0Record const &a0 = listAdmin0[it.value()];
+            region.admin0 = it.value();
+            region.sov = it.value();
+            region.disputed = (a0.type.contains("Disputed") ||
+                               a0.note.contains("Disputed"));
+            continue;
         }
 
-        size_t a1_numRecords = DBFGetRecordCount(a1_hDBF);
-        if(a1_numRecords == 0)   {
-            qDebug() << "ERROR: admin1 dbf file has no records!";
+        // if there isn't a matching adm_a3 code
+        // try to get the sovereign state instead
+        it = tableSovA3.constFind(listAdmin1[i].sov_a3);
+        if(it == tableSovA3.constEnd())   {
+            qDebug() << "ERROR: No admin0 or sov for admin1 region" << i;
             return false;
         }
 
-        // open admin1 translation csv if it exists
-        QStringList listAdmin1Subs;
-        QString pathSubs = a1_dbf;
-        pathSubs.chop(4);
-        pathSubs.append("_translations.dat");
-        bool admin1_csv_sub = getAdmin1TranslationSubs(pathSubs,listAdmin1Subs);
-        if(admin1_csv_sub)   {
-            if(listAdmin1Subs.size() == a1_numRecords)   {
-                qDebug() << "INFO: Using translation substitute file: "<< pathSubs;
-            }
-            else   {
-                qDebug() << "WARN: Translation file has wrong number "
-                            "of entries: " << listAdmin1Subs.size();
-                admin1_csv_sub = false;
-            }
-        }
+        // since there's no true corresponding entry for
+        // the admin1 region through the adm_a3 code, we
+        // can't test for disputed regions; to indicate
+        // that no admin0 region data exists for this
+        // entry, we use an index of value -1
+        region.admin0 = -1;
+        region.sov = it.value();
+        region.disputed = false;
+    }
 
-        size_t a1_idx_adm_name  = DBFGetFieldIndex(a1_hDBF,"name");
-        size_t a1_idx_adm_a3    = DBFGetFieldIndex(a1_hDBF,"sr_adm0_a3");
-        size_t a1_idx_sov_a3    = DBFGetFieldIndex(a1_hDBF,"sr_sov_a3");
-        size_t a1_idx_fclass    = DBFGetFieldIndex(a1_hDBF,"featurecla");
-        size_t a1_idx_adminname = DBFGetFieldIndex(a1_hDBF,"admin");
-
-        QStringList listSqlSaveSov;
-        QStringList listSqlSaveAdmin0;
-        QStringList listSqlSaveAdmin1;
-
-        for(size_t i=0; i < a1_numRecords; i++)   {
-            // get the name of this admin1 entry
-            QString admin1_idx = QString::number(i,10);
-            QString admin1_name(codec->toUnicode(DBFReadStringAttribute(a1_hDBF, i, a1_idx_adm_name)));
-
-            // if the adm1 fclass is an aggregation, minor island or
-            // remainder, we grab the name from another field which
-            // doesn't contain a bunch of additional metadata
-            QString fclass(codec->toUnicode(DBFReadStringAttribute(a1_hDBF, i, a1_idx_fclass)));
-            if(fclass.contains("aggregation") ||
-               fclass.contains("minor island") ||
-               fclass.contains("remainder"))
-            {
-                admin1_name = QString(codec->toUnicode(DBFReadStringAttribute(
-                                   a1_hDBF, i, a1_idx_adminname)));
-            }
-            else   {
-                // if there's no special feature class than we check
-                // to see if there's a translation substitute available
-                if(admin1_csv_sub && (listAdmin1Subs[i].size() > 0))   {
-                    admin1_name = listAdmin1Subs[i];
-                }
-            }
+    return true;
+}
 
-            // get the adm_a3,sov_a3 code for this admin1 entry
-            QString adm_a3(codec->toUnicode(DBFReadStringAttribute(a1_hDBF, i, a1_idx_adm_a3)));
-            QString sov_a3(codec->toUnicode(DBFReadStringAttribute(a1_hDBF, i, a1_idx_sov_a3)));
-
-            // check if the adm_a3 code exists in the temp database
-            QString stmt("SELECT * FROM temp WHERE adm_a3=\""+ adm_a3 + "\";");
-            pStmt->Sql(stmt.toStdString());
-
-            if(pStmt->FetchRow())   {
-                // save admin0 info
-                QString admin0_idx  = QString::number(pStmt->GetColumnInt("id"),10);
-                QString admin0_type = QString::fromStdString(pStmt->GetColumnString("type"));
-                QString admin0_note = QString::fromStdString(pStmt->GetColumnString("note"));
-                pStmt->FreeQuery();
-
-                // save admin1 info; we currently derive the
-                // disputed field from admin0 type and note fields
-                QString admin1_disputed = "0";
-                if(admin0_type.contains("Disputed") ||
-                   admin0_note.contains("Disputed"))   {
-                    admin1_disputed = "1";
-                }
+bool writeAdminRegionsToDatabase(QString const &a0_dbf,
+                                 QString const &a1_dbf,
+                                 Kompex::SQLiteDatabase * pDatabase)
+{
+    // because shapefiles are evil
+    QTextCodec * codec = QTextCodec::codecForName("windows-1252");
 
-                stmt = QString("INSERT INTO admin1(id,name,disputed,admin0,sov) VALUES(" +
-                               admin1_idx + ",\"" +
-                               admin1_name + "\"," +
-                               admin1_disputed + "," +
-                               admin0_idx + "," +
-                               admin0_idx + ");");
-                listSqlSaveAdmin1.push_back(stmt);
-            }
-            else   {
-                pStmt->FreeQuery();
-
-                // if there isn't a matching adm_a3 code in the temp
-                // database try to get the sovereign state instead
-                stmt = QString("SELECT * FROM temp WHERE sov_a3=\""+ sov_a3 + "\";");
-                pStmt->Sql(stmt.toStdString());
-
-                if(pStmt->FetchRow())   {
-                    QString sov_idx     = QString::number(pStmt->GetColumnInt("id"));
-                    pStmt->FreeQuery();
-
-                    // since there's no true corresponding entry for
-                    // the admin1 region through the adm_a3 code, we
-                    // can't test for disputed regions
-                    QString admin1_disputed = "0";
-
-                    // to indicate that no admin0 region data exists
-                    // for this entry, we use an index of value -1
-                    QString admin0_idx = "-1";
-
-                    stmt = QString("INSERT INTO admin1(id,name,disputed,admin0,sov) VALUES(" +
-                                   admin1_idx + ",\"" +
-                                   admin1_name + "\"," +
-                                   admin1_disputed + "," +
-                                   admin0_idx + "," +
-                                   sov_idx + ");");
-                    listSqlSaveAdmin1.push_back(stmt);
-                }
-                else   {
-                    // fail without a matching adm_a3 or sov_a3
-                    pStmt->FreeQuery();
-                    return false;
-                }
+    QList<Admin0Record> listAdmin0;
+    QList<Admin1Record> listAdmin1;
+    QVector<Admin1Region> listRegions;
+    if(!readAdmin0Records(a0_dbf,codec,listAdmin0) ||
+       !readAdmin1Records(a1_dbf,codec,listAdmin1) ||
+       !joinAdmin1ToAdmin0(listAdmin0,listAdmin1,listRegions))   {
+        return false;
+    }
+
+    // every statement is prepared once and then bound and
+    // reset for each row; each table is filled in a single
+    // transaction run on its own statement
+    Kompex::SQLiteStatement stmtTransaction(pDatabase);
+
+    try   {
+        // populate the admin1 table
+        {
+            Kompex::SQLiteStatement stmtInsert(pDatabase);
+            stmtInsert.Sql("INSERT INTO admin1(id,name,disputed,admin0,sov) "
+                           "VALUES(?,?,?,?,?);");
+
+            stmtTransaction.BeginTransaction();
+            for(int i=0; i < listAdmin1.size(); i++)   {
+                stmtInsert.BindInt(1,i);
+                stmtInsert.BindString(2,listAdmin1[i].name.toUtf8().constData());
+                stmtInsert.BindInt(3,listRegions[i].disputed ? 1 : 0);
+                stmtInsert.BindInt(4,listRegions[i].admin0);
+                stmtInsert.BindInt(5,listRegions[i].sov);
+                stmtInsert.Execute();
+                stmtInsert.Reset();
             }
+            stmtTransaction.CommitTransaction();
+            stmtInsert.FreeQuery();
         }
 
         // populate the admin0 and sov tables
         {
-            QString stmt("SELECT * FROM temp;");
-            pStmt->Sql(stmt.toStdString());
-
-            while(pStmt->FetchRow())   {
-                QString idx         = QString::number(pStmt->GetColumnInt("id"),10);
-                QString admin0_name = QString::fromStdString(pStmt->GetColumnString("adm_name"));
-                QString sov_name    = QString::fromStdString(pStmt->GetColumnString("sov_name"));
-
-                stmt = QString("INSERT INTO sov(id,name) VALUES("+
-                               idx + ",\"" +
-                               sov_name + "\");");
-                listSqlSaveSov.push_back(stmt);
-
-                stmt = QString("INSERT INTO admin0(id,name) VALUES("+
-                               idx + ",\"" +
-                               admin0_name + "\");");
-                listSqlSaveAdmin0.push_back(stmt);
+            Kompex::SQLiteStatement stmtInsertSov(pDatabase);
+            stmtInsertSov.Sql("INSERT INTO sov(id,name) VALUES(?,?);");
+
+            Kompex::SQLiteStatement stmtInsertAdmin0(pDatabase);
+            stmtInsertAdmin0.Sql("INSERT INTO admin0(id,name) VALUES(?,?);");
+
+            stmtTransaction.BeginTransaction();
+            for(int i=0; i < listAdmin0.size(); i++)   {
+                stmtInsertSov.BindInt(1,i);
+                stmtInsertSov.BindString(2,listAdmin0[i].sov_name.toUtf8().constData());
+                stmtInsertSov.Execute();
+                stmtInsertSov.Reset();
+
+                stmtInsertAdmin0.BindInt(1,i);
+                stmtInsertAdmin0.BindString(2,listAdmin0[i].adm_name.toUtf8().constData());
+                stmtInsertAdmin0.Execute();
+                stmtInsertAdmin0.Reset();
             }
-            pStmt->FreeQuery();
-        }
-
-        // write prepared statements
-        pStmt->BeginTransaction();
-        for(int i=0; i < listSqlSaveSov.size(); i++)   {
-            pStmt->SqlStatement(listSqlSaveSov[i].toUtf8().data());
+            stmtTransaction.CommitTransaction();
+            stmtInsertSov.FreeQuery();
+            stmtInsertAdmin0.FreeQuery();
         }
-        pStmt->CommitTransaction();
 
-        pStmt->BeginTransaction();
-        for(int i=0; i < listSqlSaveAdmin0.size(); i++)   {
-             pStmt->SqlStatement(listSqlSaveAdmin0[i].toUtf8().data());
-        }
-        pStmt->CommitTransaction();
-
-        pStmt->BeginTransaction();
-        for(int i=0; i < listSqlSaveAdmin1.size(); i++)   {
-            pStmt->SqlStatement(listSqlSaveAdmin1[i].toUtf8().data());
+        // populate the region table; admin1 regions
+        // without an admin0 region get a NULL admin0
+        {
+            Kompex::SQLiteStatement stmtInsert(pDatabase);
+            stmtInsert.Sql("INSERT INTO region(id,admin1,admin0,sov,disputed) "
+                           "VALUES(?,?,?,?,?);");
+
+            stmtTransaction.BeginTransaction();
+            for(int i=0; i < listAdmin1.size(); i++)   {
+                Admin1Region const &region = listRegions[i];
+                stmtInsert.BindInt(1,i);
+                stmtInsert.BindString(2,listAdmin1[i].name.toUtf8().constData());
+                if(region.admin0 < 0)   {
+                    stmtInsert.BindNull(3);
+                }
+                else   {
+                    stmtInsert.BindString(3,listAdmin0[region.admin0].adm_name.toUtf8().constData());
+                }
+                stmtInsert.BindString(4,listAdmin0[region.sov].sov_name.toUtf8().constData());
+                stmtInsert.BindInt(5,region.disputed ? 1 : 0);
+                stmtInsert.Execute();
+                stmtInsert.Reset();
+            }
+            stmtTransaction.CommitTransaction();
+            stmtInsert.FreeQuery();
         }
-        pStmt->CommitTransaction();
     }
-
-    // delete temp table
-    pStmt->SqlStatement("DROP TABLE temp;");
+    catch(Kompex::SQLiteException &exception)   {
+        qDebug() << "ERROR: SQLite exception writing admin regions:"
+                 << QString::fromStdString(exception.GetString());
+        return false;
+    }
 
     return true;
 }
@@ -557,16 +1051,30 @@ void badInput()
     qDebug() << "ERROR: Wrong number of arguments: ";
     qDebug() << "* Pass the directories containing the admin shapefiles. ";
     qDebug() << "* Each set of shapefiles should be in different directories. ";
-    qDebug() << "* Pass in an -optimize flag after specifying the directories ";
-    qDebug() << "  to optimize PNG files using OptiPNG (recommended!)";
+    qDebug() << "* Pass in -format png|raw16|rle16|block16 after specifying the ";
+    qDebug() << "  directories to choose how tiles are stored (default block16)";
+    qDebug() << "* Pass in -optimize [0-9] after specifying the directories to ";
+    qDebug() << "  set the zlib effort used to compress tiles (default 9); png ";
+    qDebug() << "  tiles are also written with a palette (recommended for png!)";
+    qDebug() << "* Pass in a -flat flag to also write every tile to ";
+    qDebug() << "  adminraster.flat so it can be memory mapped by lookups;";
+    qDebug() << "  -flatformat raw16|block16 sets its format (default block16)";
+    qDebug() << "* Pass in -res N to set the resolution in px/degree (default ";
+    qDebug() << "  100) and -tilesize N to set the tile size in px (default ";
+    qDebug() << "  1000, a multiple of 8); both are saved in the meta table";
+    qDebug() << "* Pass in -refine N (2 to 8) to also store the blocks of each ";
+    qDebug() << "  tile that straddle a border at N times the resolution";
+    qDebug() << "* Pass in a -geometry flag to also store the admin1 rings so ";
+    qDebug() << "  lookups on boundary pixels can be checked exactly";
+    qDebug() << "* Pass in -threads N to set the number of threads used to ";
+    qDebug() << "  render tiles (default is the number of cores)";
     qDebug() << "ex:";
-    qDebug() << "./shp2adminraster /admin0shapefiles /admin1shapefiles -optimize";
+    qDebug() << "./shp2adminraster /admin0shapefiles /admin1shapefiles -format png -optimize";
 }
 
 int main(int argc, char *argv[])
 {
     QCoreApplication app(argc,argv);
-    QString pathApp = QCoreApplication::applicationDirPath();
 
     // check input args
     QStringList inputArgs = app.arguments();
@@ -578,13 +1086,86 @@ int main(int argc, char *argv[])
         badInput();
         return -1;
     }
-    if(inputArgs.size() == 4)   {
-        if(inputArgs[3] == "-optimize")   {
-            g_optimize = true;
+    g_numThreads = std::max(QThread::idealThreadCount(),1);
+    for(int i=3; i < inputArgs.size(); i++)   {
+        if(inputArgs[i] == "-optimize")   {
+            g_effort = 9;
+            if(i+1 < inputArgs.size())   {
+                bool ok = false;
+                int effort = inputArgs[i+1].toInt(&ok);
+                if(ok)   {
+                    if(effort < 0 || effort > 9)   {
+                        badInput();
+                        return -1;
+                    }
+                    g_effort = effort;
+                    i++;
+                }
+            }
+        }
+        else if(inputArgs[i] == "-flat")   {
+            g_flat = true;
+        }
+        else if(inputArgs[i] == "-res" && i+1 < inputArgs.size())   {
+            i++;
+            g_grid.resolution = inputArgs[i].toInt();
+        }
+        else if(inputArgs[i] == "-tilesize" && i+1 < inputArgs.size())   {
+            i++;
+            g_grid.tileSize = inputArgs[i].toInt();
+        }
+        else if(inputArgs[i] == "-refine" && i+1 < inputArgs.size())   {
+            i++;
+            g_refine = inputArgs[i].toInt();
+            if(g_refine < 1 || g_refine > kTileRefineMaxFactor)   {
+                badInput();
+                return -1;
+            }
+        }
+        else if(inputArgs[i] == "-geometry")   {
+            g_geometry = true;
+        }
+        else if(inputArgs[i] == "-threads" && i+1 < inputArgs.size())   {
+            i++;
+            g_numThreads = inputArgs[i].toInt();
+            if(g_numThreads < 1)   {
+                badInput();
+                return -1;
+            }
+        }
+        else if(inputArgs[i] == "-flatformat" && i+1 < inputArgs.size())   {
+            i++;
+            if(!tileFormatFromName(inputArgs[i],g_flatFormat) ||
+               (g_flatFormat != TILE_FORMAT_RAW16 &&
+                g_flatFormat != TILE_FORMAT_BLOCK16))   {
+                badInput();
+                return -1;
+            }
+        }
+        else if(inputArgs[i] == "-format" && i+1 < inputArgs.size())   {
+            i++;
+            if(!tileFormatFromName(inputArgs[i],g_tileFormat))   {
+                badInput();
+                return -1;
+            }
+        }
+        else   {
+            badInput();
+            return -1;
         }
     }
-
-    QDir appDir(pathApp);
+    if(!g_grid.isValid())   {
+        qDebug() << "ERROR: Resolution must be 1 to" << kGridMaxResolution
+                 << "px/degree and the tile size must be a multiple of"
+                 << kTileBlockSize << "up to" << kGridMaxTileSize << "px,"
+                 << "large enough that there are at most"
+                 << kGridMaxTileCount << "tiles";
+        return -1;
+    }
+    if(!RasterGrid(g_grid.resolution*g_refine,g_grid.tileSize*g_refine).isIndexable())   {
+        qDebug() << "ERROR: Refine factor" << g_refine << "is too large for this grid";
+        return -1;
+    }
 
     // filter shapefile types
     QStringList filterList;
@@ -621,37 +1202,26 @@ int main(int argc, char *argv[])
     }
 
     // get polygons from admin1 shapefile
-    QList<QList<Vec2d> > list_a1_polys;
+    PolyStore list_a1_polys;
 
     if(!getPolysFromShapefile(a1_fileShp,list_a1_polys))   {
         return -1;
     }
 
-    // save admin1 polys as east/west images
-    appDir.mkpath(pathApp+"/admin1");
-    if(!rasterizePolygons(pathApp+"/admin1",list_a1_polys))   {
+    SHPTree * a1_polyIndex = buildPolyIndex(list_a1_polys);
+    if(a1_polyIndex == NULL)   {
         return -1;
     }
 
-    // cut images into tiles
-    qDebug() << "INFO: Splitting into tiles...";
-    QStringList listWestTileFiles;
-    QImage * imgWest = new QImage(pathApp+"/admin1/imgW.png");
-    appDir.mkpath(pathApp+"/admin1/west");
-    if(!splitImageIntoTiles(*imgWest,"admin1/west",listWestTileFiles))   {
-        qDebug() << "ERROR: Failed to split image into tiles [west]";
-        return -1;
-    }
-    delete imgWest;
-
-    QStringList listEastTileFiles;
-    QImage * imgEast = new QImage(pathApp+"/admin1/imgE.png");
-    appDir.mkpath(pathApp+"/admin1/east");
-    if(!splitImageIntoTiles(*imgEast,"admin1/east",listEastTileFiles))   {
-        qDebug() << "ERROR: Failed to split image into tiles [east]";
-        return -1;
+    // optionally write a flat raster file as well
+    FlatRasterWriter * flatWriter = NULL;
+    if(g_flat)   {
+        flatWriter = new FlatRasterWriter;
+        if(!flatWriter->open("adminraster.flat",g_grid.tileSize,
+                             g_grid.tileCount(),g_flatFormat))   {
+            return -1;
+        }
     }
-    delete imgEast;
 
     // open new database and create tables
     qDebug() << "INFO: Creating database...";
@@ -665,9 +1235,55 @@ int main(int argc, char *argv[])
 
         pStmt = new Kompex::SQLiteStatement(pDatabase);
 
+        // the database is only ever written by this process
+        // and is thrown away if the build fails, so skip the
+        // journal and syncing; page_size has to be set before
+        // any tables are created
+        pStmt->SqlStatement("PRAGMA page_size=16384;");
+        pStmt->SqlStatement("PRAGMA synchronous=OFF;");
+        pStmt->Sql("PRAGMA journal_mode=OFF;");
+        pStmt->FetchRow();
+        pStmt->FreeQuery();
+
+        pStmt->SqlStatement("CREATE TABLE IF NOT EXISTS meta("
+                            "key TEXT PRIMARY KEY NOT NULL UNIQUE,"
+                            "value TEXT NOT NULL);");
+
+        // the grid and format the lookup library reads back
+        {
+            QList<QPair<QString,QString> > listMeta;
+            listMeta.push_back(qMakePair(QString("tile_format"),
+                                         tileFormatName(g_tileFormat)));
+            listMeta.push_back(qMakePair(QString("resolution"),
+                                         QString::number(g_grid.resolution)));
+            listMeta.push_back(qMakePair(QString("tile_size"),
+                                         QString::number(g_grid.tileSize)));
+            listMeta.push_back(qMakePair(QString("refine_factor"),
+                                         QString::number(g_refine)));
+
+            Kompex::SQLiteStatement stmtTransaction(pDatabase);
+            Kompex::SQLiteStatement stmtInsert(pDatabase);
+            stmtInsert.Sql("INSERT INTO meta(key,value) VALUES(?,?);");
+
+            stmtTransaction.BeginTransaction();
+            for(int i=0; i < listMeta.size(); i++)   {
+                stmtInsert.BindString(1,listMeta[i].first.toUtf8().constData());
+                stmtInsert.BindString(2,listMeta[i].second.toUtf8().constData());
+                stmtInsert.Execute();
+                stmtInsert.Reset();
+            }
+            stmtTransaction.CommitTransaction();
+            stmtInsert.FreeQuery();
+        }
+
         pStmt->SqlStatement("CREATE TABLE IF NOT EXISTS tiles("
                             "id INTEGER PRIMARY KEY NOT NULL UNIQUE,"
-                            "png BLOB)");
+                            "data BLOB)");
+
+        // refined blocks for the tiles that have any
+        pStmt->SqlStatement("CREATE TABLE IF NOT EXISTS refined("
+                            "id INTEGER PRIMARY KEY NOT NULL UNIQUE,"
+                            "data BLOB)");
 
         pStmt->SqlStatement("CREATE TABLE IF NOT EXISTS admin1("
                             "id INTEGER PRIMARY KEY NOT NULL UNIQUE,"
@@ -683,6 +1299,24 @@ int main(int argc, char *argv[])
         pStmt->SqlStatement("CREATE TABLE IF NOT EXISTS sov("
                             "id INTEGER PRIMARY KEY NOT NULL UNIQUE,"
                             "name TEXT NOT NULL);");
+
+        // rings of each admin1 region, see regiongeometry.h
+        if(g_geometry)   {
+            pStmt->SqlStatement("CREATE TABLE IF NOT EXISTS geometry("
+                                "id INTEGER PRIMARY KEY NOT NULL UNIQUE,"
+                                "data BLOB,"
+                                "label_lon REAL,"
+                                "label_lat REAL)");
+        }
+
+        // denormalized copy of the tables above so
+        // a lookup needs a single keyed fetch
+        pStmt->SqlStatement("CREATE TABLE IF NOT EXISTS region("
+                            "id INTEGER PRIMARY KEY NOT NULL UNIQUE,"
+                            "admin1 TEXT NOT NULL,"
+                            "admin0 TEXT,"
+                            "sov TEXT,"
+                            "disputed INTEGER NOT NULL);");
     }
     catch(Kompex::SQLiteException &exception)   {
         qDebug() << "ERROR: SQLite exception creating database:"
@@ -691,19 +1325,46 @@ int main(int argc, char *argv[])
     }
 
 
-    // write tile images into database
-    qDebug() << "INFO: Writing tiles to database...";
-    QStringList listAllTileFiles;
-    listAllTileFiles.append(listWestTileFiles);
-    listAllTileFiles.append(listEastTileFiles);
-    writeTilesToDatabase(listAllTileFiles,pStmt);
+    // render admin1 polys into tiles
+    if(!rasterizeTiles(list_a1_polys,a1_polyIndex,flatWriter,pDatabase))   {
+        qDebug() << "ERROR: Failed to rasterize tiles";
+        return -1;
+    }
+    SHPDestroyTree(a1_polyIndex);
+
+    if(g_geometry)   {
+        qDebug() << "INFO: Writing region geometry to database...";
+        if(!writeGeometryToDatabase(list_a1_polys,pDatabase))   {
+            qDebug() << "ERROR: Failed to write region geometry";
+            return -1;
+        }
+    }
 
-    // remove image files
-     system("rm -rf admin1");
+    if(flatWriter)   {
+        if(!flatWriter->close())   {
+            qDebug() << "ERROR: Failed to write flat raster file";
+            return -1;
+        }
+        delete flatWriter;
+        qDebug() << "INFO: Wrote adminraster.flat";
+    }
 
     // get records from admin0 and admin1 dbf
     qDebug() << "INFO: Writing admin regions to database...";
-    writeAdminRegionsToDatabase(a0_fileDbf,a1_fileDbf,pStmt);
+    if(!writeAdminRegionsToDatabase(a0_fileDbf,a1_fileDbf,pDatabase))   {
+        qDebug() << "ERROR: Failed to write admin regions";
+        return -1;
+    }
+
+    // rebuild the database so the output is compact
+    qDebug() << "INFO: Vacuuming database...";
+    try   {
+        pStmt->SqlStatement("VACUUM;");
+    }
+    catch(Kompex::SQLiteException &exception)   {
+        qDebug() << "WARN: SQLite exception vacuuming database:"
+                 << QString::fromStdString(exception.GetString());
+    }
 
     // clean up database
     delete pStmt;
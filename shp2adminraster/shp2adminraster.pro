@@ -7,6 +7,13 @@ TEMPLATE = app
 DEFINES += SQLITE_OMIT_LOAD_EXTENSION
 
 
+# adminraster
+PATH_ADMINRASTER = $${PWD}/../adminraster
+INCLUDEPATH += $${PATH_ADMINRASTER}
+LIBS += -L$${OUT_PWD}/../adminraster -ladminraster
+PRE_TARGETDEPS += $${OUT_PWD}/../adminraster/libadminraster.a
+
+
 # kompex
 PATH_KOMPEX = /home/preet/Dev/env/sys/kompex
 INCLUDEPATH += $${PATH_KOMPEX}/include
@@ -35,4 +42,8 @@ SOURCES += \
     $${PATH_SHAPELIB}/safileio.c
 
 # main
-SOURCES += shp2adminraster.cpp
+HEADERS += idrasterizer.h
+
+SOURCES += \
+    idrasterizer.cpp \
+    shp2adminraster.cpp
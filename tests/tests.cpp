@@ -0,0 +1,522 @@
+/*
+   Copyright 2013 Preet Desai
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include <cmath>
+
+// qt
+#include <QCoreApplication>
+#include <QDebug>
+#include <QVector>
+#include <QDir>
+#include <QFile>
+
+// kompex
+#include "KompexSQLitePrerequisites.h"
+#include "KompexSQLiteDatabase.h"
+#include "KompexSQLiteStatement.h"
+#include "KompexSQLiteException.h"
+
+// adminraster
+#include "tilecodec.h"
+#include "adminrasterindex.h"
+
+// shp2adminraster
+#include "idrasterizer.h"
+
+// Self checks for the parts of the generator and the
+// lookup library that are easy to get subtly wrong.
+// Every check prints an ERROR line for what failed and
+// the program exits with -1 if any of them did
+
+namespace
+{
+    quint16 const kEmpty = 0xFFFF;
+    int const kSize = 16;
+
+    // a simple polygon ring
+    struct Ring
+    {
+        double const * x;
+        double const * y;
+        int count;
+    };
+
+    // even-odd test against the ring's edges, only
+    // used for pixel centers that aren't on an edge
+    bool ringContains(Ring const &ring, double px, double py)
+    {
+        bool inside = false;
+        for(int i=0, j=ring.count-1; i < ring.count; j=i++)   {
+            if((ring.y[i] > py) != (ring.y[j] > py))   {
+                double x = ring.x[j] + (py-ring.y[j])*
+                        (ring.x[i]-ring.x[j])/(ring.y[i]-ring.y[j]);
+                if(px < x)   {
+                    inside = !inside;
+                }
+            }
+        }
+        return inside;
+    }
+
+    void fillRings(QVector<quint16> &listIds, Ring const * rings, int numRings,
+                   quint16 id, FillRule rule)
+    {
+        listIds.fill(kEmpty,kSize*kSize);
+
+        IdRasterizer rasterizer;
+        rasterizer.setTarget(listIds.data(),kSize,kSize);
+        for(int i=0; i < numRings; i++)   {
+            rasterizer.addRing(rings[i].x,rings[i].y,rings[i].count);
+        }
+        rasterizer.fillPath(id,rule);
+    }
+
+    // fills two polygons that share an edge into separate
+    // buffers; every pixel inside their union has to be
+    // covered by exactly one of them and no other pixel
+    // can be covered at all
+    bool checkSharedEdge(char const * name, Ring const &a, Ring const &b,
+                         Ring const &outline)
+    {
+        QVector<quint16> listA,listB;
+        fillRings(listA,&a,1,1,FILL_NONZERO);
+        fillRings(listB,&b,1,2,FILL_NONZERO);
+
+        int numBad = 0;
+        for(int y=0; y < kSize; y++)   {
+            for(int x=0; x < kSize; x++)   {
+                int covered = int(listA[y*kSize+x] != kEmpty) +
+                              int(listB[y*kSize+x] != kEmpty);
+                int expected = ringContains(outline,x+0.5,y+0.5) ? 1 : 0;
+                if(covered != expected)   {
+                    numBad++;
+                }
+            }
+        }
+
+        if(numBad > 0)   {
+            qDebug() << "ERROR: Shared edge" << name << ":"
+                     << numBad << "pixels overlap or are missing";
+            return false;
+        }
+        return true;
+    }
+
+    bool checkRasterizer()
+    {
+        bool ok = true;
+
+        // two squares sharing a vertical edge that runs
+        // through a column of pixel centers
+        double const sqAx[] = { 1.0, 4.5, 4.5, 1.0 };
+        double const sqBx[] = { 4.5, 9.0, 9.0, 4.5 };
+        double const sqY[]  = { 2.0, 2.0, 12.0, 12.0 };
+        double const sqUx[] = { 1.0, 9.0, 9.0, 1.0 };
+        Ring sqA = { sqAx, sqY, 4 };
+        Ring sqB = { sqBx, sqY, 4 };
+        Ring sqU = { sqUx, sqY, 4 };
+        ok = checkSharedEdge("squares",sqA,sqB,sqU) && ok;
+
+        // two triangles sharing a diagonal, once through
+        // pixel centers and once at an odd slope; the
+        // second triangle is wound the other way
+        double const diagAx[] = { 1.0, 13.0, 1.0 };
+        double const diagAy[] = { 1.0, 13.0, 13.0 };
+        double const diagBx[] = { 1.0, 13.0, 13.0 };
+        double const diagBy[] = { 1.0, 13.0, 1.0 };
+        double const diagUx[] = { 1.0, 13.0, 13.0, 1.0 };
+        double const diagUy[] = { 1.0, 1.0, 13.0, 13.0 };
+        Ring diagA = { diagAx, diagAy, 3 };
+        Ring diagB = { diagBx, diagBy, 3 };
+        Ring diagU = { diagUx, diagUy, 4 };
+        ok = checkSharedEdge("diagonal",diagA,diagB,diagU) && ok;
+
+        double const skewAx[] = { 0.3, 15.1, 0.3 };
+        double const skewAy[] = { 0.7, 11.3, 15.0 };
+        double const skewBx[] = { 0.3, 15.1, 15.1 };
+        double const skewBy[] = { 0.7, 11.3, 0.7 };
+        double const skewUx[] = { 0.3, 15.1, 15.1, 0.3 };
+        double const skewUy[] = { 0.7, 0.7, 11.3, 15.0 };
+        Ring skewA = { skewAx, skewAy, 3 };
+        Ring skewB = { skewBx, skewBy, 3 };
+        Ring skewU = { skewUx, skewUy, 4 };
+        ok = checkSharedEdge("skewed diagonal",skewA,skewB,skewU) && ok;
+
+        // a square with a square hole, with the hole wound
+        // against the outer ring for nonzero and the same
+        // way as the outer ring for even-odd
+        double const outerX[] = { 1.0, 15.0, 15.0, 1.0 };
+        double const outerY[] = { 1.0, 1.0, 15.0, 15.0 };
+        double const holeX[]  = { 5.0, 11.0, 11.0, 5.0 };
+        double const holeY[]  = { 5.0, 5.0, 11.0, 11.0 };
+        double const holeRevX[] = { 5.0, 5.0, 11.0, 11.0 };
+        double const holeRevY[] = { 5.0, 11.0, 11.0, 5.0 };
+        Ring outer = { outerX, outerY, 4 };
+        Ring hole = { holeX, holeY, 4 };
+
+        for(int r=0; r < 2; r++)   {
+            FillRule rule = (r == 0) ? FILL_NONZERO : FILL_EVENODD;
+            Ring rings[2] = { outer, hole };
+            if(rule == FILL_NONZERO)   {
+                rings[1].x = holeRevX;
+                rings[1].y = holeRevY;
+            }
+
+            QVector<quint16> listIds;
+            fillRings(listIds,rings,2,7,rule);
+
+            int numBad = 0;
+            for(int y=0; y < kSize; y++)   {
+                for(int x=0; x < kSize; x++)   {
+                    bool expected = ringContains(outer,x+0.5,y+0.5) &&
+                                    !ringContains(hole,x+0.5,y+0.5);
+                    quint16 id = listIds[y*kSize+x];
+                    if(id != (expected ? 7 : kEmpty))   {
+                        numBad++;
+                    }
+                }
+            }
+            if(numBad > 0)   {
+                qDebug() << "ERROR: Hole"
+                         << ((rule == FILL_NONZERO) ? "nonzero" : "even-odd")
+                         << ":" << numBad << "pixels are wrong";
+                ok = false;
+            }
+        }
+
+        return ok;
+    }
+
+    // tiles used for the codec checks: a uniform tile, a few
+    // large regions with some no region pixels, and noise
+    // with more ids than fit in a png palette
+    int const kNumTilePatterns = 3;
+
+    void makeTile(int tileSize, int pattern, QVector<quint16> &listIds)
+    {
+        listIds.fill(42,tileSize*tileSize);
+        quint32 seed = 1234;
+        for(int y=0; y < tileSize; y++)   {
+            for(int x=0; x < tileSize; x++)   {
+                quint16 &id = listIds[y*tileSize+x];
+                if(pattern == 1)   {
+                    id = ((x*3+y*7)/29) % 5;
+                    if(id == 4)   {
+                        id = kTileNoRegion;
+                    }
+                }
+                else if(pattern == 2)   {
+                    seed = seed*1103515245 + 12345;
+                    id = (seed >> 16) % 1000;
+                }
+            }
+        }
+    }
+
+    bool checkTileFormats()
+    {
+        TileFormat const listFormats[] = {
+            TILE_FORMAT_PNG,
+            TILE_FORMAT_RAW16,
+            TILE_FORMAT_RLE16,
+            TILE_FORMAT_BLOCK16
+        };
+        int const numFormats = 4;
+        int const listSizes[] = { 8, 24, 64 };
+        int const numSizes = 3;
+
+        bool ok = true;
+        for(int f=0; f < numFormats; f++)   {
+            for(int s=0; s < numSizes; s++)   {
+                for(int p=0; p < kNumTilePatterns; p++)   {
+                    // the default effort and an explicit one,
+                    // which writes palette pngs when it can
+                    for(int e=0; e < 2; e++)   {
+                        int const tileSize = listSizes[s];
+                        int const effort = (e == 0) ? kTileEffortDefault : 6;
+
+                        QVector<quint16> listIds;
+                        makeTile(tileSize,p,listIds);
+
+                        QByteArray data;
+                        QVector<quint16> listDecoded;
+                        if(!encodeTileIds(listIds,tileSize,listFormats[f],data,effort) ||
+                           !decodeTileIds(data,tileSize,listFormats[f],listDecoded) ||
+                           listDecoded != listIds)   {
+                            qDebug() << "ERROR: Round trip failed for format"
+                                     << f << "tile size" << tileSize
+                                     << "pattern" << p << "effort" << effort;
+                            ok = false;
+                        }
+                    }
+                }
+            }
+        }
+
+        // rle runs that don't cover the tile and
+        // raw tiles of the wrong size are rejected
+        QVector<quint16> listIds;
+        makeTile(8,1,listIds);
+        QVector<quint16> listDecoded;
+        for(int f=1; f < 3; f++)   {
+            QByteArray data;
+            encodeTileIds(listIds,8,listFormats[f],data);
+            data.chop(4);
+            if(decodeTileIds(data,8,listFormats[f],listDecoded))   {
+                qDebug() << "ERROR: Truncated tile accepted for format" << f;
+                ok = false;
+            }
+        }
+
+        return ok;
+    }
+
+    bool checkBlockTiles()
+    {
+        quint16 const listLayouts[] = { kTileBlockRowMajor, kTileBlockZOrder };
+        int const listSizes[] = { 8, 16, 40, 64, 200 };
+        int const numSizes = 5;
+
+        bool ok = true;
+        for(int l=0; l < 2; l++)   {
+            for(int s=0; s < numSizes; s++)   {
+                for(int p=0; p < kNumTilePatterns; p++)   {
+                    int const tileSize = listSizes[s];
+                    quint16 const layout = listLayouts[l];
+
+                    QVector<quint16> listIds;
+                    makeTile(tileSize,p,listIds);
+
+                    QByteArray data;
+                    QVector<quint16> listDecoded;
+                    if(!encodeBlockTile(listIds,tileSize,data,layout) ||
+                       !decodeBlockTile(data,tileSize,listDecoded) ||
+                       listDecoded != listIds)   {
+                        qDebug() << "ERROR: Block tile round trip failed for layout"
+                                 << layout << "tile size" << tileSize
+                                 << "pattern" << p;
+                        ok = false;
+                        continue;
+                    }
+
+                    // sampling in place has to agree with decoding
+                    uchar const * tileData =
+                            reinterpret_cast<uchar const *>(data.constData());
+                    int numBad = 0;
+                    for(int y=0; y < tileSize; y++)   {
+                        for(int x=0; x < tileSize; x++)   {
+                            if(sampleBlockTile(tileData,tileSize,x,y) !=
+                               listIds[y*tileSize+x])   {
+                                numBad++;
+                            }
+                        }
+                    }
+                    if(numBad > 0)   {
+                        qDebug() << "ERROR: Block tile sampling failed for layout"
+                                 << layout << "tile size" << tileSize
+                                 << "pattern" << p << ":" << numBad << "pixels";
+                        ok = false;
+                    }
+
+                    // no truncated tile can be sampled safely
+                    for(int size=0; size < data.size(); size++)   {
+                        if(checkBlockTile(tileData,size,tileSize))   {
+                            qDebug() << "ERROR: Block tile truncated to" << size
+                                     << "of" << data.size() << "bytes accepted";
+                            ok = false;
+                            break;
+                        }
+                    }
+                    if(decodeBlockTile(data.left(data.size()-1),tileSize,listDecoded))   {
+                        qDebug() << "ERROR: Truncated block tile decoded";
+                        ok = false;
+                    }
+                }
+            }
+        }
+
+        // a table entry that points past the end of
+        // the pool and a bad header are rejected
+        int const tileSize = 16;
+        QVector<quint16> listIds;
+        makeTile(tileSize,2,listIds);
+        QByteArray data;
+        encodeBlockTile(listIds,tileSize,data);
+
+        int const numBlocks = (data.size()-kTileBlockHeaderSize-
+                               4*blockTableSize(tileSize/kTileBlockSize,kTileBlockZOrder))/
+                              (kTileBlockSize*kTileBlockSize*2);
+        QByteArray badPool(data);
+        qToLittleEndian<quint32>(numBlocks,
+                                 reinterpret_cast<uchar*>(badPool.data())+kTileBlockHeaderSize);
+        QByteArray badLayout(data);
+        qToLittleEndian<quint16>(2,reinterpret_cast<uchar*>(badLayout.data())+2);
+        QByteArray badBlockSize(data);
+        qToLittleEndian<quint16>(16,reinterpret_cast<uchar*>(badBlockSize.data()));
+
+        QByteArray const * listBad[] = { &badPool, &badLayout, &badBlockSize };
+        for(int i=0; i < 3; i++)   {
+            if(checkBlockTile(reinterpret_cast<uchar const *>(listBad[i]->constData()),
+                              listBad[i]->size(),tileSize))   {
+                qDebug() << "ERROR: Corrupt block tile" << i << "accepted";
+                ok = false;
+            }
+        }
+
+        return ok;
+    }
+
+    // writes a database with two uniform tiles next to each
+    // other, region 0 in tile 0 and region 1 in tile 1, and
+    // geometry that puts the border between them at x=7.5,
+    // half a pixel into tile 0. Points in the last column of
+    // tile 0 right of the border can only be resolved if the
+    // lookup checks the pixels in tile 1
+    bool writeSeamDatabase(QString const &pathDatabase)
+    {
+        int const tileSize = 8;
+        try   {
+            Kompex::SQLiteDatabase database(pathDatabase.toStdString(),
+                                            SQLITE_OPEN_READWRITE |
+                                            SQLITE_OPEN_CREATE,0);
+            Kompex::SQLiteStatement stmt(&database);
+
+            stmt.SqlStatement("CREATE TABLE meta("
+                              "key TEXT PRIMARY KEY NOT NULL UNIQUE,"
+                              "value TEXT NOT NULL);");
+            stmt.SqlStatement("INSERT INTO meta(key,value) VALUES"
+                              "('tile_format','raw16'),"
+                              "('resolution','1'),"
+                              "('tile_size','8'),"
+                              "('refine_factor','1');");
+
+            stmt.SqlStatement("CREATE TABLE tiles("
+                              "id INTEGER PRIMARY KEY NOT NULL UNIQUE,"
+                              "data BLOB)");
+            stmt.SqlStatement("CREATE TABLE geometry("
+                              "id INTEGER PRIMARY KEY NOT NULL UNIQUE,"
+                              "data BLOB,"
+                              "label_lon REAL,"
+                              "label_lat REAL)");
+            stmt.SqlStatement("CREATE TABLE region("
+                              "id INTEGER PRIMARY KEY NOT NULL UNIQUE,"
+                              "admin1 TEXT NOT NULL,"
+                              "admin0 TEXT,"
+                              "sov TEXT,"
+                              "disputed INTEGER NOT NULL);");
+            stmt.SqlStatement("INSERT INTO region(id,admin1,admin0,sov,disputed) VALUES"
+                              "(0,'West','Seam','Seam',0),"
+                              "(1,'East','Seam','Seam',0);");
+
+            double const listBorder[2][2] = { { 0.0, 7.5 }, { 7.5, 16.0 } };
+            for(int r=0; r < 2; r++)   {
+                QVector<quint16> listIds(tileSize*tileSize,quint16(r));
+                QByteArray tileData;
+                encodeTileIds(listIds,tileSize,TILE_FORMAT_RAW16,tileData);
+
+                stmt.Sql("INSERT INTO tiles(id,data) VALUES(?,?);");
+                stmt.BindInt(1,r);
+                stmt.BindBlob(2,tileData.constData(),tileData.size());
+                stmt.ExecuteAndFree();
+
+                QVector<double> listX,listY;
+                QVector<int> listRingStart;
+                listX.push_back(listBorder[r][0]);  listY.push_back(0.0);
+                listX.push_back(listBorder[r][1]);  listY.push_back(0.0);
+                listX.push_back(listBorder[r][1]);  listY.push_back(8.0);
+                listX.push_back(listBorder[r][0]);  listY.push_back(8.0);
+                listRingStart.push_back(0);
+                listRingStart.push_back(listX.size());
+
+                QByteArray geometryData;
+                encodeRegionGeometry(listX,listY,listRingStart,geometryData);
+
+                stmt.Sql("INSERT INTO geometry(id,data) VALUES(?,?);");
+                stmt.BindInt(1,r);
+                stmt.BindBlob(2,geometryData.constData(),geometryData.size());
+                stmt.ExecuteAndFree();
+            }
+        }
+        catch(Kompex::SQLiteException &exception)   {
+            qDebug() << "ERROR: Could not write the seam database:";
+            qDebug() << QString::fromStdString(exception.GetString());
+            return false;
+        }
+        return true;
+    }
+
+    bool checkTileSeams()
+    {
+        QString pathDatabase = QDir::temp().filePath("adminraster_tests.sqlite");
+        QFile::remove(pathDatabase);
+        if(!writeSeamDatabase(pathDatabase))   {
+            QFile::remove(pathDatabase);
+            return false;
+        }
+
+        bool ok = true;
+        AdminRasterIndex index;
+        if(!index.open(pathDatabase))   {
+            qDebug() << "ERROR: Could not open the seam database";
+            ok = false;
+        }
+        else   {
+            // pixel (7,3) of tile 0 on both sides of the border
+            double const listLonLat[] = { 7.8-180.0, 86.5, 7.2-180.0, 86.5 };
+            int const listExpected[] = { 1, 0 };
+            int listIds[2];
+            index.lookupIds(listLonLat,2,listIds);
+
+            for(int i=0; i < 2; i++)   {
+                int id = index.lookupId(listLonLat[i*2],listLonLat[i*2+1]);
+                if(id != listExpected[i] || listIds[i] != listExpected[i])   {
+                    qDebug() << "ERROR: Point" << i << "next to a tile edge is in region"
+                             << id << "/" << listIds[i] << "instead of" << listExpected[i];
+                    ok = false;
+                }
+            }
+            index.close();
+        }
+
+        QFile::remove(pathDatabase);
+        return ok;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc,argv);
+
+    bool ok = true;
+
+    qDebug() << "INFO: Checking the id rasterizer...";
+    ok = checkRasterizer() && ok;
+
+    qDebug() << "INFO: Checking the tile codecs...";
+    ok = checkTileFormats() && ok;
+    ok = checkBlockTiles() && ok;
+
+    qDebug() << "INFO: Checking lookups along tile edges...";
+    ok = checkTileSeams() && ok;
+
+    if(!ok)   {
+        qDebug() << "ERROR: Some checks failed";
+        return -1;
+    }
+    qDebug() << "INFO: All checks passed";
+    return 0;
+}
@@ -0,0 +1,39 @@
+QT       += core
+
+CONFIG   += console
+TEMPLATE = app
+
+# avoid linking in dl since we dont use it
+DEFINES += SQLITE_OMIT_LOAD_EXTENSION
+
+
+# adminraster
+PATH_ADMINRASTER = $${PWD}/../adminraster
+INCLUDEPATH += $${PATH_ADMINRASTER}
+LIBS += -L$${OUT_PWD}/../adminraster -ladminraster
+PRE_TARGETDEPS += $${OUT_PWD}/../adminraster/libadminraster.a
+
+
+# kompex
+PATH_KOMPEX = /home/preet/Dev/env/sys/kompex
+INCLUDEPATH += $${PATH_KOMPEX}/include
+HEADERS += \
+    $${PATH_KOMPEX}/include/sqlite3.h \
+    $${PATH_KOMPEX}/include/KompexSQLiteStreamRedirection.h \
+    $${PATH_KOMPEX}/include/KompexSQLiteStatement.h \
+    $${PATH_KOMPEX}/include/KompexSQLitePrerequisites.h \
+    $${PATH_KOMPEX}/include/KompexSQLiteException.h \
+    $${PATH_KOMPEX}/include/KompexSQLiteDatabase.h \
+    $${PATH_KOMPEX}/include/KompexSQLiteBlob.h
+
+LIBS += -L$${PATH_KOMPEX}/lib -lkompex
+
+
+# shp2adminraster
+PATH_SHP2ADMINRASTER = $${PWD}/../shp2adminraster
+INCLUDEPATH += $${PATH_SHP2ADMINRASTER}
+HEADERS += $${PATH_SHP2ADMINRASTER}/idrasterizer.h
+SOURCES += $${PATH_SHP2ADMINRASTER}/idrasterizer.cpp
+
+# main
+SOURCES += tests.cpp